@@ -1,2 +0,0 @@
-void setup_shutter_control();
-void run_shutter_control();
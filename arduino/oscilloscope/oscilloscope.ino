@@ -1,29 +1,146 @@
-int nMillis = 0;
-int val0 = 0;
-int val1 = 0;
-
-void setup() {
-  Serial.begin(2000000);
-}
-
-// Background info, see: https://www.gammon.com.au/adc
-void loop() {
-  val0 = analogRead(A0);
-  val1 = analogRead(A1);
-  if (nMillis < 10000) {
-    // Duration of 2 x 10000 analogReads without Serial.write is ~2250 ms
-    nMillis += 1;
-  } else {
-    Serial.println();
-    Serial.println("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!");
-    Serial.print("Millis for 10000 analog measurements: ");
-    Serial.println(millis());
-    nMillis = 0;
-  }
-  // Duration of 2 x 10000 analogReads including Serial.write is ~ 2500 ms
-  Serial.write( 0xff );
-  Serial.write( (val0 >> 8) & 0xff );
-  Serial.write( val0 & 0xff );
-  Serial.write( (val1 >> 8) & 0xff );
-  Serial.write( val1 & 0xff );
-}
+/*
+Two-channel oscilloscope on A0 and A1 (see doc/arduino-scope.md).
+
+By default, loop() reads A0 and A1 with analogRead() and sends each pair as 5 bytes: 0xff, then A0 and A1
+as 16 bits big endian, which is the format of the Processing display in arduino/processing_oscilloscope.
+The spacing of these samples depends on analogRead() and the serial port, about 8000 conversions per second.
+
+With FAST_SAMPLING, TIMER1 triggers the conversions of the ADC itself, 2 * PAIR_HZ times per second,
+alternately of A0 and A1, so the samples are evenly spaced whatever the code is doing. The ADC clock runs
+at 1 MHz (prescaler 16) instead of the 125 kHz of analogRead(), which costs some accuracy in the lowest bits
+but gives conversions of 13.5 microseconds. The ADC interrupt packs each pair into 3 bytes of a block with a
+sequence number and the index of its first pair (see scope_block.h). Of the two blocks in RAM, the
+interrupt fills one while loop() sends the other one straight to the UART data register. When a block is
+full while the other one is still being sent, it is overwritten, and the gap in the sequence numbers
+shows the loss.
+*/
+#define FAST_SAMPLING
+#undef FAST_SAMPLING                                  // Outcomment to sample at a fixed rate and send packed blocks (see scope_block.h)
+
+#include "scope_block.h"
+
+const unsigned long BAUD = 2000000;
+
+#ifdef FAST_SAMPLING
+const unsigned long PAIR_HZ = 20000;                  // Sample pairs (A0 and A1) per second
+const unsigned int PAIR_CYCLES = F_CPU / PAIR_HZ;     // CPU cycles per sample pair, two conversions
+const unsigned int ADC_CYCLES = 16 * 15;              // 13.5 ADC clocks per auto-triggered conversion at prescaler 16, plus margin
+const byte ADMUX_A0 = _BV(REFS0);                     // AVcc reference, input A0
+const byte ADMUX_A1 = _BV(REFS0) | 1;                 // AVcc reference, input A1
+
+static_assert(F_CPU % (2 * PAIR_HZ) == 0, "the conversions need a whole number of CPU cycles in between");
+static_assert(PAIR_CYCLES / 2 >= ADC_CYCLES, "a conversion has to end before the next trigger");
+static_assert(PAIR_HZ / BLOCK_PAIRS * BLOCK_SIZE <= BAUD / 10 * 9 / 10, "the blocks need 90% of the UART or less");
+
+byte blocks[2][BLOCK_SIZE];
+volatile byte fillBlock = 0;                          // Block that the ADC interrupt fills
+volatile bool blockFull[2] = {false, false};          // Waiting for loop() to send it
+byte nPairs = 0;                                      // Pairs in the block being filled
+byte blockSeq = 0;                                    // Sequence number of the next block
+unsigned long pairIndex = 0;                          // Sample pairs since the start of the sampling
+bool sampleA1 = false;                                // The conversion in progress is of A1
+unsigned int valueA0 = 0;                             // A0 of the pair in progress
+
+ISR(ADC_vect)
+{
+  TIFR1 = _BV(OCF1B);                                 // The ADC starts on the rising edge of this flag, so clear it for the next compare match
+  unsigned int value = ADC;
+  // The next conversion starts at the next compare match, well after this change of the input
+  if (!sampleA1) {
+    ADMUX = ADMUX_A1;
+    sampleA1 = true;
+    valueA0 = value;
+    return;
+  }
+  ADMUX = ADMUX_A0;
+  sampleA1 = false;
+  packPair(blocks[fillBlock] + BLOCK_HEADER + 3 * nPairs, valueA0, value);
+  pairIndex++;
+  if (++nPairs < BLOCK_PAIRS) {
+    return;
+  }
+  nPairs = 0;
+  byte other = fillBlock ^ 1;
+  if (!blockFull[other]) {
+    blockFull[fillBlock] = true;
+    fillBlock = other;
+  }
+  encodeBlockHeader(blocks[fillBlock], blockSeq++, pairIndex, PAIR_CYCLES);
+}
+
+void sendBlock(byte *block)
+{
+  // Straight to the UART data register, without the transmit interrupt of HardwareSerial, which would
+  // cost an interrupt per byte
+  block[BLOCK_SIZE - 1] = blockChecksum(block);
+  for (unsigned int i = 0; i < BLOCK_SIZE; i++) {
+    while (!(UCSR0A & _BV(UDRE0))) {}
+    UDR0 = block[i];
+  }
+}
+
+void setup() {
+  Serial.begin(BAUD);
+  Serial.print("Fast sampling of A0 and A1, pairs per second: ");
+  Serial.println(PAIR_HZ);
+  Serial.flush();
+
+  encodeBlockHeader(blocks[0], blockSeq++, 0, PAIR_CYCLES);
+  DIDR0 = _BV(ADC0D) | _BV(ADC1D);                    // No digital input buffers on A0 and A1
+  ADMUX = ADMUX_A0;
+  ADCSRA = _BV(ADEN) | _BV(ADPS2);                    // Prescaler 16: 1 MHz ADC clock
+  ADCSRA |= _BV(ADSC);                                // The first conversion takes 25 ADC clocks, so do it before the timed ones
+  while (ADCSRA & _BV(ADSC)) {}
+  ADCSRB = _BV(ADTS2) | _BV(ADTS0);                   // Auto trigger source: TIMER1 compare match B
+
+  // TIMER1 in CTC mode at prescaler 1, with a compare match B at the start of each conversion period
+  TCCR1A = 0;
+  TCCR1B = 0;
+  TCNT1 = 0;
+  OCR1A = PAIR_CYCLES / 2 - 1;
+  OCR1B = 0;
+  TIFR1 = _BV(OCF1B);
+  ADCSRA = _BV(ADEN) | _BV(ADATE) | _BV(ADIE) | _BV(ADIF) | _BV(ADPS2);
+  TCCR1B = _BV(WGM12) | _BV(CS10);
+}
+
+void loop() {
+  // The ADC interrupt only sets blockFull for the block it stops filling
+  byte i = fillBlock ^ 1;
+  if (blockFull[i]) {
+    sendBlock(blocks[i]);
+    blockFull[i] = false;
+  }
+}
+
+#else
+int nMillis = 0;
+int val0 = 0;
+int val1 = 0;
+
+void setup() {
+  Serial.begin(BAUD);
+}
+
+// Background info, see: https://www.gammon.com.au/adc
+void loop() {
+  val0 = analogRead(A0);
+  val1 = analogRead(A1);
+  if (nMillis < 10000) {
+    // Duration of 2 x 10000 analogReads without Serial.write is ~2250 ms
+    nMillis += 1;
+  } else {
+    Serial.println();
+    Serial.println("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!");
+    Serial.print("Millis for 10000 analog measurements: ");
+    Serial.println(millis());
+    nMillis = 0;
+  }
+  // Duration of 2 x 10000 analogReads including Serial.write is ~ 2500 ms
+  Serial.write( 0xff );
+  Serial.write( (val0 >> 8) & 0xff );
+  Serial.write( val0 & 0xff );
+  Serial.write( (val1 >> 8) & 0xff );
+  Serial.write( val1 & 0xff );
+}
+#endif
@@ -0,0 +1,89 @@
+/*
+Blocks of the fast sampling mode of the oscilloscope (FAST_SAMPLING in oscilloscope.ino), shared with the
+host tools so that both sides agree on the layout.
+
+The sketch sends the samples of A0 and A1 in blocks of BLOCK_PAIRS sample pairs, each block with the layout:
+
+  byte 0       BLOCK_SYNC0
+  byte 1       BLOCK_SYNC1
+  byte 2       sequence number, incremented per block, also for blocks dropped when the UART falls behind
+  bytes 3-6    index of the first sample pair of the block since the start of the sampling (32 bits, little endian)
+  bytes 7-8    CPU cycles per sample pair (16 bits, little endian), 800 for 20000 pairs per second at 16 MHz
+  bytes 9-392  sample pairs of 3 bytes each: the 20 bits A0 | A1 << 10, little endian
+  byte 393     checksum over bytes 2-392
+
+The sample pairs are evenly spaced, so the time of pair n of a block is (firstPair + n) * pairCycles CPU
+cycles after the start of the sampling. A1 is sampled half a pair period after A0.
+
+The sync bytes can also occur in the samples, so a reader that lost track of the blocks looks for the sync
+bytes and accepts a block only with a valid checksum.
+*/
+#ifndef SCOPE_BLOCK_H
+#define SCOPE_BLOCK_H
+
+#include <stdint.h>
+
+const uint8_t BLOCK_SYNC0 = 0xA5;
+const uint8_t BLOCK_SYNC1 = 0x5A;
+const uint8_t BLOCK_PAIRS = 128;                      // Sample pairs per block
+const uint8_t BLOCK_HEADER = 9;                       // Bytes before the first sample pair
+const uint16_t BLOCK_SIZE = BLOCK_HEADER + 3 * BLOCK_PAIRS + 1;  // Bytes per block, including sync and checksum
+
+struct BlockHeader {
+  uint8_t seq;
+  uint32_t firstPair;
+  uint16_t pairCycles;
+};
+
+inline void encodeBlockHeader(uint8_t *block, uint8_t seq, uint32_t firstPair, uint16_t pairCycles)
+{
+  block[0] = BLOCK_SYNC0;
+  block[1] = BLOCK_SYNC1;
+  block[2] = seq;
+  for (uint8_t i = 0; i < 4; i++) {
+    block[3 + i] = firstPair >> (8 * i);
+  }
+  block[7] = pairCycles;
+  block[8] = pairCycles >> 8;
+}
+
+inline void decodeBlockHeader(const uint8_t *block, BlockHeader &header)
+{
+  header.seq = block[2];
+  header.firstPair = 0;
+  for (uint8_t i = 0; i < 4; i++) {
+    header.firstPair |= (uint32_t)block[3 + i] << (8 * i);
+  }
+  header.pairCycles = block[7] | block[8] << 8;
+}
+
+// Two 10-bit conversions in 3 bytes, with byte operations only, which are cheap on the AVR
+inline void packPair(uint8_t *p, uint16_t a0, uint16_t a1)
+{
+  p[0] = a0;
+  p[1] = (a0 >> 8) | (a1 << 2);
+  p[2] = a1 >> 6;
+}
+
+inline void unpackPair(const uint8_t *p, uint16_t &a0, uint16_t &a1)
+{
+  a0 = p[0] | (p[1] & 0x03) << 8;
+  a1 = p[1] >> 2 | (p[2] & 0x0F) << 6;
+}
+
+// Rotate and xor over the bytes between sync and checksum, like the telemetry frames of the shutter firmware
+inline uint8_t blockChecksum(const uint8_t *block)
+{
+  uint8_t checksum = BLOCK_SYNC0;
+  for (uint16_t i = 2; i < BLOCK_SIZE - 1; i++) {
+    checksum = ((checksum << 1) | (checksum >> 7)) ^ block[i];
+  }
+  return checksum;
+}
+
+inline bool validBlock(const uint8_t *block)
+{
+  return block[0] == BLOCK_SYNC0 && block[1] == BLOCK_SYNC1 && block[BLOCK_SIZE - 1] == blockChecksum(block);
+}
+
+#endif
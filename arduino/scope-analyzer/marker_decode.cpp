@@ -0,0 +1,487 @@
+/*
+ * Host decoder of the second markers in a light curve measured behind an LCD shutter, from the fast
+ * sampling stream of the oscilloscope sketch (FAST_SAMPLING, see scope_block.h), with the phototransistor
+ * on A1 by default.
+ *
+ * The waveform of the shutter firmware repeats every second: SHUTTER_HZ dark pulses of shutPercentage of a
+ * wave, except in the marker waves (MARKER_WAVES, see shutter_waveform.h), whose dark pulse is left out. The
+ * decoder correlates the samples with this pattern of one second, which does not need the GPS pulse: it
+ * finds the start of each second as the firmware intended it, as far as the light behind the shutter shows.
+ *
+ *  - The number of samples per second follows from the autocorrelation of the light curve around one
+ *    nominal second, because the clock of the oscilloscope is only accurate to about 0.5%.
+ *  - The first lock searches all lags of one second, later seconds only TRACK_WINDOW around the expected
+ *    start. The sub-sample start of a second is the top of a parabola through the correlation at the
+ *    best lag and its two neighbours.
+ *  - The confidence compares the correlation at the found start with the best correlation at a start that
+ *    is a whole number of waves away, which differs only in the marker waves. It is 1 for an ideal light
+ *    curve, and about 0 without markers, e.g. while the firmware is not locked to the GPS pulses.
+ *
+ * The pattern is a sum of steps, so its correlation with the samples at a lag is a weighted sum of a few
+ * values of the prefix sum of the samples (correlate()). For a range of lags, each step adds a scaled copy
+ * of a contiguous piece of the prefix sums, a loop without branches that the compiler turns into SIMD
+ * instructions. An hour of samples takes a few seconds.
+ *
+ * Prints one CSV line per second on stdout and a summary on stderr. The pattern defaults to the first
+ * channel of shutter_waveform.h.
+ *
+ * Usage: marker_decode [--hz N] [--shut PERCENT] [--offset PERCENT] [--markers MASK] [--channel 0|1] [FILE]
+ */
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+
+#include "scope_block.h"
+#include "shutter_waveform.h"
+
+const double CPU_HZ = 16e6;                           // Nominal clock of the oscilloscope
+const double MAX_CLOCK_ERROR = 0.01;                  // Range of the autocorrelation around one nominal second
+const double TRACK_WINDOW = 0.0025;                   // Search range around the expected start of a second, in seconds
+const double LOCK_CONFIDENCE = 0.5;                   // Smallest confidence for a first lock
+const double LOST_CONFIDENCE = 0.25;                  // A lock is lost after LOST_SECONDS seconds below this confidence
+const int LOST_SECONDS = 3;
+const double PERIOD_GAIN = 0.125;                     // Weight of the last second in the tracked length of a second
+
+struct Options {
+  int hz = SHUTTER_HZ;
+  double shut = SHUTTER_CHANNELS[0].shutPercentage;
+  double offset = SHUTTER_CHANNELS[0].offsetPercentage;
+  uint32_t markers = MARKER_WAVES;
+  int channel = 1;
+  const char *inputPath = nullptr;
+};
+
+// The correlation at a lag gets weight * P(lag + pos), with P the linearly interpolated prefix sum
+struct Tap {
+  size_t index;                                       // Integer part of pos
+  double frac;                                        // Fractional part of pos
+  double weight;
+};
+
+// corr[j] = sum of the taps at lag first + j, j = 0 .. n - 1
+static void correlate(const double *__restrict prefix, size_t first, const std::vector<Tap> &taps, size_t n,
+  double *__restrict corr)
+{
+  for (size_t j = 0; j < n; j++) {
+    corr[j] = 0;
+  }
+  for (const Tap &tap : taps) {
+    const double *__restrict p = prefix + first + tap.index;
+    double a = tap.weight * (1 - tap.frac);
+    double b = tap.weight * tap.frac;
+    for (size_t j = 0; j < n; j++) {
+      corr[j] += a * p[j] + b * p[j + 1];
+    }
+  }
+}
+
+// sum of x[i] * x[i + lag] for i = 0 .. n - 1
+static double dot(const double *__restrict x, const double *__restrict y, size_t n)
+{
+  double sum = 0;
+  for (size_t i = 0; i < n; i++) {
+    sum += x[i] * y[i];
+  }
+  return sum;
+}
+
+// Offset of the top of the parabola through (-1, left), (0, mid), (1, right)
+static double parabolaTop(double left, double mid, double right)
+{
+  double d = left - 2 * mid + right;
+  return d < 0 ? 0.5 * (left - right) / d : 0;
+}
+
+struct MarkerDecoder {
+  Options opt;
+  double nominalSamples = 0;                          // Samples per second at the nominal clock
+  double pairCycles = 0;
+  std::vector<double> x;                              // Samples from pair index base on
+  uint64_t base = 0;
+  std::vector<double> prefix;                         // prefix[i] = x[0] + ... + x[i - 1]
+  std::vector<double> corr;
+  bool locked = false;
+  double samples = 0;                                 // Tracked samples per second
+  double start = 0;                                   // Start of the last second, in samples after base
+  double polarity = 1;                                // -1 when the light curve is inverted
+  std::vector<Tap> taps;                              // Pattern of one second of the tracked length
+  double idealMargin = 1;                             // Confidence margin of an ideal light curve
+  int lowSeconds = 0;
+
+  // Statistics for the summary
+  unsigned long nSeconds = 0;
+  unsigned long nLocks = 0;
+  unsigned long nResets = 0;
+  double sumConfidence = 0;
+  double minConfidence = 1;
+  double sumSamples = 0;
+  double lastTime = -1;
+  unsigned long nIntervals = 0;
+  double sumInterval = 0;
+  double sumInterval2 = 0;
+
+  // Dark parts of the waves in seconds, split at the end of the second
+  std::vector<std::pair<double, double>> darkParts() const
+  {
+    std::vector<std::pair<double, double>> parts;
+    for (int w = 0; w < opt.hz; w++) {
+      if (opt.markers >> w & 1) {
+        continue;
+      }
+      double begin = (w + opt.offset / 100) / opt.hz;
+      double end = begin + opt.shut / 100 / opt.hz;
+      if (end > 1) {
+        parts.push_back({begin, 1});
+        parts.push_back({0, end - 1});
+      } else {
+        parts.push_back({begin, end});
+      }
+    }
+    return parts;
+  }
+
+  void makeTaps(double n)
+  {
+    // Zero-mean transmission: (1 - m) everywhere minus 1 in the dark parts, with m the light fraction
+    std::vector<std::pair<double, double>> parts = darkParts();
+    double dark = 0;
+    for (const auto &part : parts) {
+      dark += part.second - part.first;
+    }
+    double light = 1 - dark;
+    std::vector<std::pair<double, double>> steps = {{0, -light}, {n, light}};
+    for (const auto &part : parts) {
+      steps.push_back({part.first * n, 1});
+      steps.push_back({part.second * n, -1});
+    }
+    taps.clear();
+    for (const auto &step : steps) {
+      double index = floor(step.first);
+      taps.push_back({(size_t)index, step.first - index, step.second});
+    }
+  }
+
+  // Confidence margin of the pattern itself, as the light curve of an ideal shutter with n samples per second
+  void measureIdealMargin(double n)
+  {
+    std::vector<std::pair<double, double>> parts = darkParts();
+    size_t len = (size_t)ceil(2 * n) + 2;
+    std::vector<double> ideal(len), idealPrefix(len + 1, 0);
+    for (size_t i = 0; i < len; i++) {
+      double t = (i + 0.5) / n;
+      t -= floor(t);
+      ideal[i] = 1;
+      for (const auto &part : parts) {
+        if (t >= part.first && t < part.second) {
+          ideal[i] = 0;
+        }
+      }
+      idealPrefix[i + 1] = idealPrefix[i] + ideal[i];
+    }
+    idealMargin = 1;
+    double best = correlateAt(idealPrefix.data(), 0);
+    double other = bestOther(idealPrefix.data(), 0, n);
+    if (best > 0 && best > other) {
+      idealMargin = (best - other) / best;
+    }
+  }
+
+  double correlateAt(const double *p, double lag)
+  {
+    double c;
+    size_t first = (size_t)floor(lag);
+    correlate(p, first, taps, 1, &c);
+    double c1;
+    correlate(p, first + 1, taps, 1, &c1);
+    double f = lag - first;
+    return (1 - f) * c + f * c1;
+  }
+
+  // Best correlation at a start a whole number of waves away from lag, within the second after lag - n
+  double bestOther(const double *p, double lag, double n)
+  {
+    double best = -INFINITY;
+    for (int k = 1; k < opt.hz; k++) {
+      double other = lag + k * n / opt.hz;
+      double c = correlateAt(p, other >= n ? other - n : other);
+      best = c > best ? c : best;
+    }
+    return best;
+  }
+
+  void makePrefix(size_t n)
+  {
+    prefix.resize(n + 1);
+    prefix[0] = 0;
+    for (size_t i = 0; i < n; i++) {
+      prefix[i + 1] = prefix[i] + x[i];
+    }
+  }
+
+  // Samples per second, from the peak of the autocorrelation around one nominal second
+  double measureSeconds()
+  {
+    size_t n = (size_t)nominalSamples;
+    double mean = 0;
+    for (size_t i = 0; i < n; i++) {
+      mean += x[i];
+    }
+    mean /= n;
+    size_t lo = (size_t)(nominalSamples * (1 - MAX_CLOCK_ERROR));
+    size_t hi = (size_t)(nominalSamples * (1 + MAX_CLOCK_ERROR));
+    std::vector<double> y(n + hi + 1);
+    for (size_t i = 0; i < y.size(); i++) {
+      y[i] = x[i] - mean;
+    }
+    std::vector<double> r(hi - lo + 1);
+    for (size_t lag = lo; lag <= hi; lag++) {
+      r[lag - lo] = dot(y.data(), y.data() + lag, n);
+    }
+    size_t best = 1;
+    for (size_t i = 1; i + 1 < r.size(); i++) {
+      best = r[i] > r[best] ? i : best;
+    }
+    return lo + best + parabolaTop(r[best - 1], r[best], r[best + 1]);
+  }
+
+  double confidence(double lag, double c)
+  {
+    double other = polarity * bestOther(prefix.data(), lag, samples);
+    return c > 0 ? (c - other) / c / idealMargin : 0;
+  }
+
+  void emit(double lag, double conf)
+  {
+    double pair = base + lag + (opt.channel == 1 ? 0.5 : 0);
+    double time = pair * pairCycles / CPU_HZ;
+    printf("%lu,%.3f,%.7f,%.3f,%.2f\n", nSeconds, pair, time, samples, conf);
+    nSeconds++;
+    sumConfidence += conf;
+    minConfidence = conf < minConfidence ? conf : minConfidence;
+    sumSamples += samples;
+    if (lastTime >= 0) {
+      double interval = time - lastTime;
+      nIntervals++;
+      sumInterval += interval;
+      sumInterval2 += interval * interval;
+    }
+    lastTime = time;
+  }
+
+  // Drops the samples before lag, keeping a margin for the next search
+  void drop(double lag)
+  {
+    size_t n = (size_t)floor(lag);
+    x.erase(x.begin(), x.begin() + n);
+    base += n;
+    start -= n;
+  }
+
+  bool acquire()
+  {
+    if (x.size() < (size_t)(nominalSamples * (2 + 2 * MAX_CLOCK_ERROR)) + 4) {
+      return false;
+    }
+    samples = measureSeconds();
+    makeTaps(samples);
+    measureIdealMargin(samples);
+    size_t n = (size_t)ceil(samples);
+    makePrefix(x.size());
+    corr.resize(n + 2);
+    correlate(prefix.data(), 0, taps, n + 2, corr.data());
+    size_t best = 1;
+    for (size_t j = 1; j <= n; j++) {
+      best = fabs(corr[j]) > fabs(corr[best]) ? j : best;
+    }
+    polarity = corr[best] < 0 ? -1 : 1;
+    double lag = best + parabolaTop(polarity * corr[best - 1], polarity * corr[best], polarity * corr[best + 1]);
+    double conf = confidence(lag, polarity * corr[best]);
+    if (conf < LOCK_CONFIDENCE) {
+      drop(samples);
+      return true;
+    }
+    locked = true;
+    nLocks++;
+    lowSeconds = 0;
+    start = lag;
+    emit(lag, conf);
+    return true;
+  }
+
+  bool track()
+  {
+    double window = TRACK_WINDOW * samples;
+    double expected = start + samples;
+    if (x.size() < (size_t)ceil(expected + window + 2 * samples) + 2) {
+      return false;
+    }
+    size_t first = (size_t)floor(expected - window);
+    size_t n = (size_t)ceil(2 * window) + 1;
+    makePrefix(x.size());
+    corr.resize(n);
+    correlate(prefix.data(), first, taps, n, corr.data());
+    size_t best = 1;
+    for (size_t j = 1; j + 1 < n; j++) {
+      best = polarity * corr[j] > polarity * corr[best] ? j : best;
+    }
+    double lag = first + best +
+      parabolaTop(polarity * corr[best - 1], polarity * corr[best], polarity * corr[best + 1]);
+    double conf = confidence(lag, polarity * corr[best]);
+    samples += PERIOD_GAIN * (lag - start - samples);
+    makeTaps(samples);
+    start = lag;
+    emit(lag, conf);
+    lowSeconds = conf < LOST_CONFIDENCE ? lowSeconds + 1 : 0;
+    if (lowSeconds == LOST_SECONDS) {
+      locked = false;
+    }
+    if (start > window + 2) {
+      drop(start - window - 2);
+    }
+    return true;
+  }
+
+  void push(uint64_t pair, double value)
+  {
+    // Lost blocks: repeat the last sample, which only weakens the correlation of these seconds
+    while (base + x.size() < pair) {
+      x.push_back(x.empty() ? value : x.back());
+    }
+    x.push_back(value);
+  }
+
+  // Starts over at pair after a reset of the oscilloscope, keeping the statistics
+  void restart(uint64_t pair)
+  {
+    nResets++;
+    x.clear();
+    base = pair;
+    locked = false;
+    lowSeconds = 0;
+    start = 0;
+    lastTime = -1;                                                  // No second length across the reset
+  }
+
+  void process()
+  {
+    while (locked ? track() : acquire()) {}
+  }
+
+  void summary() const
+  {
+    fprintf(stderr, "Seconds: %lu, locks: %lu, resets: %lu\n", nSeconds, nLocks, nResets);
+    if (nSeconds) {
+      fprintf(stderr, "Confidence: mean %.2f, min %.2f\n", sumConfidence / nSeconds, minConfidence);
+      fprintf(stderr, "Oscilloscope clock: %+.0f ppm\n", (sumSamples / nSeconds / nominalSamples - 1) * 1e6);
+    }
+    if (nIntervals > 1) {
+      double mean = sumInterval / nIntervals;
+      double sd = sqrt(fmax(0, (sumInterval2 - nIntervals * mean * mean) / (nIntervals - 1)));
+      fprintf(stderr, "Second length: mean %.6f s, sd %.1f us\n", mean, sd * 1e6);
+    }
+  }
+};
+
+static bool parseArgs(int argc, char **argv, Options &opt)
+{
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (i + 1 < argc && !strcmp(arg, "--hz")) {
+      opt.hz = atoi(argv[++i]);
+    } else if (i + 1 < argc && !strcmp(arg, "--shut")) {
+      opt.shut = atof(argv[++i]);
+    } else if (i + 1 < argc && !strcmp(arg, "--offset")) {
+      opt.offset = atof(argv[++i]);
+    } else if (i + 1 < argc && !strcmp(arg, "--markers")) {
+      opt.markers = strtoul(argv[++i], nullptr, 0);
+    } else if (i + 1 < argc && !strcmp(arg, "--channel")) {
+      opt.channel = atoi(argv[++i]);
+    } else if ((arg[0] != '-' || !arg[1]) && !opt.inputPath) {
+      opt.inputPath = arg;
+    } else {
+      return false;
+    }
+  }
+  return opt.hz > 0 && opt.hz <= 32 && opt.shut > 0 && opt.shut < 100 && opt.offset >= 0 && opt.offset < 100 &&
+    (opt.channel == 0 || opt.channel == 1);
+}
+
+int main(int argc, char **argv)
+{
+  MarkerDecoder decoder;
+  if (!parseArgs(argc, argv, decoder.opt)) {
+    fprintf(stderr, "Usage: marker_decode [--hz N] [--shut PERCENT] [--offset PERCENT] [--markers MASK] [--channel 0|1] [FILE]\n");
+    return 2;
+  }
+  const Options &opt = decoder.opt;
+  if ((opt.markers & ((1ULL << opt.hz) - 1)) == 0) {
+    fprintf(stderr, "The pattern needs at least one marker wave\n");
+    return 2;
+  }
+  int fd = STDIN_FILENO;
+  if (opt.inputPath && strcmp(opt.inputPath, "-")) {
+    fd = open(opt.inputPath, O_RDONLY | O_NOCTTY);
+    if (fd < 0) {
+      perror(opt.inputPath);
+      return 1;
+    }
+  }
+
+  printf("second,pair,time_s,samples_per_s,confidence\n");
+  static uint8_t buffer[1 << 16];
+  size_t fill = 0;
+  uint64_t nextPair = 0;
+  bool started = false;
+  ssize_t n;
+  while ((n = read(fd, buffer + fill, sizeof(buffer) - fill)) > 0) {
+    fill += n;
+    size_t pos = 0;
+    while (fill - pos >= BLOCK_SIZE) {
+      if (!validBlock(buffer + pos)) {
+        pos++;
+        continue;
+      }
+      BlockHeader header;
+      decodeBlockHeader(buffer + pos, header);
+      uint32_t gap = header.firstPair - (uint32_t)nextPair;
+      if (started && gap >= 0x80000000u) {
+        // The oscilloscope was reset: decode the samples before it, then start over at the new pair index
+        decoder.process();
+        decoder.restart(header.firstPair);
+        nextPair = header.firstPair;
+        gap = 0;
+      }
+      uint64_t first = nextPair + gap;
+      if (!started) {
+        started = true;
+        first = header.firstPair;
+        decoder.base = first;
+        decoder.pairCycles = header.pairCycles;
+        decoder.nominalSamples = CPU_HZ / header.pairCycles;
+      }
+      const uint8_t *p = buffer + pos + BLOCK_HEADER;
+      for (uint8_t i = 0; i < BLOCK_PAIRS; i++, p += 3) {
+        uint16_t a0, a1;
+        unpackPair(p, a0, a1);
+        decoder.push(first + i, opt.channel == 1 ? a1 : a0);
+      }
+      nextPair = first + BLOCK_PAIRS;
+      pos += BLOCK_SIZE;
+    }
+    memmove(buffer, buffer + pos, fill - pos);
+    fill -= pos;
+    if (started) {
+      decoder.process();
+    }
+  }
+  if (n < 0) {
+    perror("read");
+    return 1;
+  }
+  decoder.summary();
+  return 0;
+}
@@ -0,0 +1,101 @@
+#!/bin/sh
+# Checks scope_analyze and marker_decode against synthetic recordings of scope_synth with known edge delays
+# and second starts (see doc/arduino-scope.md). Keeps the recordings and outputs in build/ and exits with
+# status 1 if any test fails.
+
+cd "$(dirname "$0")" || exit 1
+out=build
+mkdir -p $out
+failed=0
+
+# Value of a name in the stderr of scope_synth
+truth() {
+  awk -v name="$1" '$1 == name { print $2 }' $out/$2.truth
+}
+
+check() {
+  if [ "$2" = ok ]; then
+    echo "PASS $1"
+  else
+    echo "FAIL $1: $2"
+    failed=1
+  fi
+}
+
+# Generates a recording, then checks the delays of all edges and the start and confidence of every second
+synth() {
+  name=$1
+  shift
+  ./scope_synth "$@" > $out/$name.bin 2> $out/$name.truth
+  ./scope_analyze $out/$name.bin > $out/$name.edges
+  ./marker_decode $out/$name.bin > $out/$name.csv 2> $out/$name.markers
+}
+
+check_edges() {
+  name=$1
+  # Each edge of the pulse train comes a whole number of waves after the first one of its direction
+  check "$name edges" "$(awk -v falling="$(truth falling_us $name)" -v rising="$(truth rising_us $name)" '
+    $1 == "falling" || $1 == "rising" {
+      expected = $1 == "falling" ? falling : rising
+      error = $2 - expected - int(($2 - expected) / 62500 + 0.5) * 62500
+      if (error < -5 || error > 5) { print $1 " edge at " $2 " us is " error " us off"; bad = 1; exit }
+      n++
+    }
+    END { if (!bad) print (n == 30 ? "ok" : n " edges instead of 30") }' $out/$name.edges)"
+}
+
+# The fitted pattern lands about 27 us after marker_us, as the light is not a perfect step
+check_markers() {
+  name=$1
+  minSeconds=$2
+  check "$name markers" "$(awk -F, -v pps="$(truth pairs_per_second $name)" -v first="$(truth first_marker_s $name)" \
+      -v marker="$(truth marker_us $name)" -v min="$minSeconds" '
+    NR > 1 {
+      error = ($2 / pps - first - $1) * 1e6 - marker
+      if (error < -50 || error > 50) { print "second " $1 " starts " error " us off"; bad = 1; exit }
+      if ($5 < 0.8) { print "second " $1 " has confidence " $5; bad = 1; exit }
+      n++
+    }
+    END { if (!bad) print (n >= min ? "ok" : n " seconds instead of at least " min) }' $out/$name.csv)"
+}
+
+make -s scope_synth scope_analyze marker_decode || exit 1
+
+# A perfect board, with a clock error that walks the GPS pulse through the samples
+synth clean --duration 300 --clock-ppm 777
+check_edges clean
+check_markers clean 290
+./scope_analyze --max-jitter 40 $out/clean.bin > /dev/null
+check "clean acceptance" "$([ $? -eq 0 ] && echo ok || echo "a jitter-free board fails --max-jitter 40")"
+
+# The other end of the resonator tolerance, with the GPS pulse late in the second. Not -4000 ppm: a whole
+# number of pairs per second would keep the pulse at the same place between two samples
+synth slow --duration 300 --clock-ppm -3913 --pps-offset 0.9 --seed 2
+check_edges slow
+check_markers slow 290
+
+# Jittery edges: the spread shows up and the acceptance test fails
+synth jitter --duration 120 --jitter-ns 10000 --seed 3
+check "jitter spread" "$(awk '$1 == "falling" { sd = $7 + 0; if (sd < 8 || sd > 12) { print "sd " sd " us instead of 10 us"; exit } }
+  END { print "ok" }' $out/jitter.edges | head -1)"
+./scope_analyze --max-jitter 40 $out/jitter.bin > /dev/null
+check "jitter acceptance" "$([ $? -eq 1 ] && echo ok || echo "a jittery board passes --max-jitter 40")"
+
+# A reset of the oscilloscope in the middle of a recording starts the pair index over: the seconds after it
+# are those of the same recording alone
+synth short --duration 60
+cat $out/short.bin $out/short.bin > $out/reset.bin
+./marker_decode $out/reset.bin > $out/reset.csv 2> $out/reset.markers
+status=$?
+tail -n +2 $out/short.csv | cut -d, -f2 > $out/short.pairs
+tail -n +2 $out/reset.csv | cut -d, -f2 > $out/reset.pairs
+check "reset markers" "$(if [ $status -ne 0 ]; then echo "exit status $status"
+  elif ! grep -q 'resets: 1' $out/reset.markers; then head -1 $out/reset.markers
+  elif ! cat $out/short.pairs $out/short.pairs | cmp -s - $out/reset.pairs; then echo "other seconds than twice the recording"
+  else echo ok; fi)"
+
+# A shutter driver that never locks shows no markers
+synth unlocked --duration 60 --unlocked 1000
+check "unlocked markers" "$(grep -q 'locks: 0' $out/unlocked.markers && echo ok || echo "$(head -1 $out/unlocked.markers)")"
+
+exit $failed
@@ -0,0 +1,416 @@
+/*
+ * Host analyzer of the fast sampling stream of the oscilloscope sketch (FAST_SAMPLING, see scope_block.h),
+ * with the GPS pulse on A0 and the phototransistor behind the LCD shutter on A1 (see doc/arduino-scope.md).
+ *
+ * Reads the serial output of the oscilloscope from a serial device or a recorded file (default stdin).
+ * The blocks are checked and decoded in place in the read buffer, one sample at a time, so the analyzer
+ * keeps up with the 2 Mbaud of the serial port and an hour of recording takes a few seconds. A serial
+ * device is set to 2 Mbaud raw mode first, and --record saves the raw stream for a later analysis.
+ *
+ * Each channel goes through an edge detector with hysteresis. The levels of a channel follow the lowest
+ * and the highest sample of the previous second, so any GPS pulse level and any light level work. The
+ * time of an edge is interpolated linearly between the two samples around the middle level. The time of
+ * each edge on A1 is reported relative to the last GPS pulse on A0 in microseconds. The resonator of an
+ * Arduino Uno is only accurate to about 0.5%, so the oscilloscope clock is measured against the GPS pulses.
+ * As the GPS pulse is a step, its time is only known to within a sample pair (50 microseconds), which in
+ * the length of a single second would be a scale error of up to 50 ppm. Therefore a least-squares line
+ * through the last FIT_PULSES GPS pulses gives the time of the last pulse and the length of a second, and
+ * edges are only timed once MIN_FIT_PULSES pulses are in the fit. Edges at the same moment of the second
+ * (within CLUSTER_MICROS) are collected into one statistic, so the summary shows the delay and the jitter
+ * of every edge of the pulse train.
+ *
+ * With --max-jitter, the exit status is 1 when a block was lost or corrupted, when no GPS pulse or shutter
+ * edge was seen, or when the delay of an edge varied by more than the given number of microseconds (peak to
+ * peak), which makes it an acceptance test of a board.
+ *
+ * Usage: scope_analyze [--edges] [--seconds N] [--max-jitter US] [--record FILE] [/dev/ttyUSB0 | FILE]
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <vector>
+
+#include "scope_block.h"
+
+const double CPU_HZ = 16e6;                           // Nominal clock of the oscilloscope, until the GPS pulses measure it
+const double CLUSTER_MICROS = 2000;                   // Edges closer than this to an earlier edge of the second belong to it
+const double MAX_CLOCK_ERROR = 0.02;                  // Intervals of the GPS pulses further than this from whole seconds restart the fit
+const size_t FIT_PULSES = 64;                         // GPS pulses in the least-squares fit of the oscilloscope clock
+const size_t MIN_FIT_PULSES = 16;                     // GPS pulses in the fit before the edges are timed
+const int MIN_SWING = 50;                             // Smallest difference between the levels of a channel, in ADC units
+
+struct Options {
+  bool edges = false;
+  long seconds = 0;                                   // Stop after so many GPS pulses, 0 for the whole input
+  double maxJitter = -1;                              // Peak to peak limit in microseconds, negative for none
+  const char *recordPath = nullptr;
+  const char *inputPath = nullptr;
+};
+
+// Edge detector with hysteresis around the middle of the levels of the previous window
+struct EdgeDetector {
+  int windowMin = 1023;
+  int windowMax = 0;
+  double mid = 0;
+  double hysteresis = 0;
+  bool armed = false;                                 // Levels known from a complete window
+  bool known = false;                                 // high is the state of the signal
+  bool high = false;
+  bool valid = false;                                 // prev is the previous sample, without a gap in between
+  double prev = 0;
+  double prevCycle = 0;
+  bool crossed = false;                               // crossCycle holds a crossing since the last edge
+  double crossCycle = 0;                              // Interpolated crossing of the middle level
+
+  void endWindow()
+  {
+    armed = windowMax - windowMin >= MIN_SWING;
+    known = known && armed;
+    mid = (windowMin + windowMax) / 2.;
+    hysteresis = (windowMax - windowMin) / 10.;
+    windowMin = 1023;
+    windowMax = 0;
+  }
+
+  // Returns +1 for a rising and -1 for a falling edge at edgeCycle, 0 for none
+  int push(int value, double cycle, double &edgeCycle)
+  {
+    windowMin = value < windowMin ? value : windowMin;
+    windowMax = value > windowMax ? value : windowMax;
+    int edge = 0;
+    if (armed && !known) {
+      high = value >= mid;
+      known = true;
+    } else if (armed) {
+      if (valid && (prev < mid) != (value < mid)) {
+        crossed = true;
+        crossCycle = prevCycle + (mid - prev) / (value - prev) * (cycle - prevCycle);
+      }
+      if (high != (value >= mid) && fabs(value - mid) >= hysteresis) {
+        high = !high;
+        edge = high ? 1 : -1;
+        edgeCycle = crossed ? crossCycle : cycle;
+        crossed = false;
+      }
+    }
+    prev = value;
+    prevCycle = cycle;
+    valid = true;
+    return edge;
+  }
+};
+
+// Least-squares line through the times of the last FIT_PULSES GPS pulses, in oscilloscope clock cycles over
+// the seconds counted from the first pulse, which averages out the sampling of the pulse edges
+struct PpsFit {
+  std::vector<long> seconds;
+  std::vector<double> cycles;
+  double lastCycle = 0;                               // Fitted time of the last pulse
+  double secondCycles = CPU_HZ;                       // Fitted length of a second
+
+  size_t size() const
+  {
+    return seconds.size();
+  }
+
+  void clear()
+  {
+    seconds.clear();
+    cycles.clear();
+  }
+
+  // Adds a pulse at the given number of seconds after the previous one
+  void add(long afterSeconds, double cycle)
+  {
+    seconds.push_back(seconds.empty() ? 0 : seconds.back() + afterSeconds);
+    cycles.push_back(cycle);
+    if (seconds.size() > FIT_PULSES) {
+      seconds.erase(seconds.begin());
+      cycles.erase(cycles.begin());
+    }
+    lastCycle = cycle;
+    if (seconds.size() < 2) {
+      return;
+    }
+    // Relative to the first pulse of the fit, for the precision of the sums
+    double n = seconds.size(), sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (size_t i = 0; i < seconds.size(); i++) {
+      double x = seconds[i] - seconds[0];
+      double y = cycles[i] - cycles[0];
+      sx += x;
+      sy += y;
+      sxx += x * x;
+      sxy += x * y;
+    }
+    secondCycles = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+    lastCycle = cycles[0] + (sy - secondCycles * sx) / n + secondCycles * (seconds.back() - seconds[0]);
+  }
+};
+
+// Delays of the edges at about the same moment of each second
+struct EdgeStats {
+  int direction;
+  unsigned long n = 0;
+  double mean = 0;
+  double m2 = 0;                                      // Sum of the squared deviations from the mean (Welford)
+  double min = 0;
+  double max = 0;
+
+  void add(double micros)
+  {
+    n++;
+    double delta = micros - mean;
+    mean += delta / n;
+    m2 += delta * (micros - mean);
+    min = n == 1 || micros < min ? micros : min;
+    max = n == 1 || micros > max ? micros : max;
+  }
+};
+
+struct Analyzer {
+  Options opt;
+  EdgeDetector pps;
+  EdgeDetector light;
+  std::vector<EdgeStats> stats;
+  unsigned long nBlocks = 0;
+  unsigned long lostBlocks = 0;
+  unsigned long badBytes = 0;                         // Bytes skipped after the first block, corrupted blocks
+  bool started = false;
+  uint64_t nextPair = 0;                              // Index of the next sample pair, extended beyond 32 bits
+  uint64_t windowEnd = 0;                             // First sample pair of the next level window
+  double pairsPerSecond = 0;
+  long nPps = 0;
+  double ppsCycle = -1;                               // Measured time of the last GPS pulse in oscilloscope clock cycles
+  PpsFit fit;
+  double sumSecondCycles = 0;
+  long nSecondCycles = 0;
+
+  bool done() const
+  {
+    return opt.seconds > 0 && nPps > opt.seconds;
+  }
+
+  void ppsEdge(double cycle)
+  {
+    // A missing pulse leaves a gap of whole seconds in the fit, any other interval starts it over
+    long afterSeconds = 0;
+    if (ppsCycle >= 0) {
+      double interval = cycle - ppsCycle;
+      afterSeconds = lround(interval / fit.secondCycles);
+      if (afterSeconds == 1 && fabs(interval / fit.secondCycles - 1) < MAX_CLOCK_ERROR) {
+        sumSecondCycles += interval;
+        nSecondCycles++;
+      }
+      if (afterSeconds < 1 || fabs(interval / (afterSeconds * fit.secondCycles) - 1) >= MAX_CLOCK_ERROR) {
+        fit.clear();
+      }
+    }
+    fit.add(afterSeconds, cycle);
+    ppsCycle = cycle;
+    nPps++;
+  }
+
+  void lightEdge(int direction, double cycle)
+  {
+    if (fit.size() < MIN_FIT_PULSES || cycle - ppsCycle > fit.secondCycles * (1 + MAX_CLOCK_ERROR)) {
+      return;                                                       // Clock not measured yet, or no GPS pulse in the last second
+    }
+    double micros = (cycle - fit.lastCycle) / fit.secondCycles * 1e6;
+    if (opt.edges) {
+      printf("%ld %s %.1f\n", nPps, direction > 0 ? "rising" : "falling", micros);
+    }
+    for (EdgeStats &s : stats) {
+      if (s.direction == direction && fabs(s.mean - micros) < CLUSTER_MICROS) {
+        s.add(micros);
+        return;
+      }
+    }
+    stats.push_back(EdgeStats{direction});
+    stats.back().add(micros);
+  }
+
+  void block(const uint8_t *data)
+  {
+    BlockHeader header;
+    decodeBlockHeader(data, header);
+    uint32_t gap = header.firstPair - (uint32_t)nextPair;
+    if (started && gap >= 0x80000000u) {
+      // The oscilloscope was reset: start over, but keep the statistics
+      lostBlocks++;
+      started = false;
+      nextPair = header.firstPair;
+      ppsCycle = -1;
+      fit.clear();
+      pps = EdgeDetector();
+      light = EdgeDetector();
+      gap = 0;
+    }
+    uint64_t first = nextPair + gap;
+    if (!started) {
+      started = true;
+      windowEnd = first + (uint64_t)(CPU_HZ / header.pairCycles);
+    } else if (first != nextPair) {
+      lostBlocks += (first - nextPair + BLOCK_PAIRS - 1) / BLOCK_PAIRS;
+      pps.valid = false;                                            // No interpolation across the gap
+      light.valid = false;
+    }
+    nBlocks++;
+    pairsPerSecond = CPU_HZ / header.pairCycles;
+    double cycle = (double)first * header.pairCycles;
+    double halfPair = header.pairCycles / 2.;
+    const uint8_t *p = data + BLOCK_HEADER;
+    for (uint8_t i = 0; i < BLOCK_PAIRS; i++, p += 3, cycle += header.pairCycles) {
+      if (first + i >= windowEnd) {
+        pps.endWindow();
+        light.endWindow();
+        windowEnd += (uint64_t)pairsPerSecond;
+      }
+      uint16_t a0, a1;
+      unpackPair(p, a0, a1);
+      double edgeCycle;
+      if (pps.push(a0, cycle, edgeCycle) > 0) {
+        ppsEdge(edgeCycle);
+      }
+      int direction = light.push(a1, cycle + halfPair, edgeCycle);
+      if (direction) {
+        lightEdge(direction, edgeCycle);
+      }
+    }
+    nextPair = first + BLOCK_PAIRS;
+  }
+
+  // Decodes the complete blocks in data and returns the number of bytes used; the rest is the start of a
+  // block that continues in the next read
+  size_t scan(const uint8_t *data, size_t size)
+  {
+    size_t pos = 0;
+    while (size - pos >= BLOCK_SIZE && !done()) {
+      if (validBlock(data + pos)) {
+        block(data + pos);
+        pos += BLOCK_SIZE;
+      } else {
+        badBytes += started;                                        // Text before the first block is expected
+        pos++;
+      }
+    }
+    return pos;
+  }
+
+  // Returns whether the board passes the acceptance test
+  bool summary() const
+  {
+    printf("Blocks: %lu, lost: %lu, corrupted bytes: %lu\n", nBlocks, lostBlocks, badBytes);
+    printf("Sample pairs: %lu at %.0f per second\n", nBlocks * BLOCK_PAIRS, pairsPerSecond);
+    printf("GPS pulses: %ld\n", nPps);
+    if (nSecondCycles) {
+      double hz = sumSecondCycles / nSecondCycles;
+      printf("Oscilloscope clock: %.0f Hz (%+.0f ppm)\n", hz, (hz / CPU_HZ - 1) * 1e6);
+    }
+    double worst = 0;
+    printf("Shutter edges after the GPS pulse:\n");
+    std::vector<EdgeStats> sorted = stats;
+    std::sort(sorted.begin(), sorted.end(), [](const EdgeStats &a, const EdgeStats &b) { return a.mean < b.mean; });
+    for (const EdgeStats &s : sorted) {
+      double sd = s.n > 1 ? sqrt(s.m2 / (s.n - 1)) : 0;
+      printf("  %-7s %9.1f us: n %lu, sd %.1f us, min %.1f us, max %.1f us, peak to peak %.1f us\n",
+        s.direction > 0 ? "rising" : "falling", s.mean, s.n, sd, s.min, s.max, s.max - s.min);
+      worst = s.max - s.min > worst ? s.max - s.min : worst;
+    }
+    if (opt.maxJitter < 0) {
+      return true;
+    }
+    bool pass = nPps > 1 && !stats.empty() && lostBlocks == 0 && badBytes == 0 && worst <= opt.maxJitter;
+    printf("%s: worst peak to peak %.1f us, limit %.1f us\n", pass ? "PASS" : "FAIL", worst, opt.maxJitter);
+    return pass;
+  }
+};
+
+static bool setRawMode(int fd)
+{
+  termios tty;
+  if (tcgetattr(fd, &tty) != 0) {
+    return false;
+  }
+  cfmakeraw(&tty);
+  cfsetispeed(&tty, B2000000);
+  cfsetospeed(&tty, B2000000);
+  tty.c_cflag |= CLOCAL | CREAD;
+  return tcsetattr(fd, TCSANOW, &tty) == 0;
+}
+
+static bool parseArgs(int argc, char **argv, Options &opt)
+{
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (!strcmp(arg, "--edges")) {
+      opt.edges = true;
+    } else if (i + 1 < argc && !strcmp(arg, "--seconds")) {
+      opt.seconds = atol(argv[++i]);
+    } else if (i + 1 < argc && !strcmp(arg, "--max-jitter")) {
+      opt.maxJitter = atof(argv[++i]);
+    } else if (i + 1 < argc && !strcmp(arg, "--record")) {
+      opt.recordPath = argv[++i];
+    } else if ((arg[0] != '-' || !arg[1]) && !opt.inputPath) {
+      opt.inputPath = arg;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  Analyzer analyzer;
+  if (!parseArgs(argc, argv, analyzer.opt)) {
+    fprintf(stderr, "Usage: scope_analyze [--edges] [--seconds N] [--max-jitter US] [--record FILE] [/dev/ttyUSB0 | FILE]\n");
+    return 2;
+  }
+  const Options &opt = analyzer.opt;
+  int fd = STDIN_FILENO;
+  if (opt.inputPath && strcmp(opt.inputPath, "-")) {
+    fd = open(opt.inputPath, O_RDONLY | O_NOCTTY);
+    if (fd < 0) {
+      perror(opt.inputPath);
+      return 1;
+    }
+  }
+  if (isatty(fd) && !setRawMode(fd)) {
+    perror("tcsetattr");
+    return 1;
+  }
+  FILE *record = nullptr;
+  if (opt.recordPath && !(record = fopen(opt.recordPath, "wb"))) {
+    perror(opt.recordPath);
+    return 1;
+  }
+
+  static uint8_t buffer[1 << 16];
+  size_t fill = 0;
+  ssize_t n = 0;
+  while (!analyzer.done() && (n = read(fd, buffer + fill, sizeof(buffer) - fill)) > 0) {
+    if (record) {
+      fwrite(buffer + fill, 1, n, record);
+    }
+    fill += n;
+    size_t used = analyzer.scan(buffer, fill);
+    memmove(buffer, buffer + used, fill - used);
+    fill -= used;
+    if (opt.edges) {
+      fflush(stdout);
+    }
+  }
+  if (n < 0) {
+    perror("read");
+    return 1;
+  }
+  if (record) {
+    fclose(record);
+  }
+  return analyzer.summary() ? 0 : 1;
+}
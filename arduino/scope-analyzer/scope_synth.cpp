@@ -0,0 +1,182 @@
+/*
+ * Synthetic recording of the fast sampling stream of the oscilloscope sketch (FAST_SAMPLING, see
+ * scope_block.h), for testing scope_analyze and marker_decode against known values (make test).
+ *
+ * A0 carries the GPS pulse: PPS_LEVEL for the first 100 milliseconds of each true second, from
+ * --pps-offset on. A1 is the light behind an LCD shutter driven with the first channel of
+ * shutter_waveform.h: each dark pulse starts --delay-us after the start of its wave, the light falls
+ * towards DARK_LEVEL and rises back towards LIGHT_LEVEL exponentially, with the time constants of a
+ * phototransistor circuit. The marker waves show no dark pulse, except during the first --unlocked
+ * seconds, which mimic a shutter driver that is not yet locked to the GPS signal. The oscilloscope clock
+ * runs --clock-ppm off, and each edge can get a random timing error (--jitter-ns), each sample ADC noise.
+ *
+ * The blocks go to stdout after the text line that the sketch sends at its start. The values that the
+ * tools should find go to stderr, one "name value" per line:
+ *
+ *   pairs_per_second   sample pairs per true second
+ *   first_marker_s     true time of the first second with markers, the start of its wave 0
+ *   falling_us         middle of the falling light after the start of a wave
+ *   rising_us          middle of the rising light after the start of a wave
+ *   marker_us          start of a second as the pattern of marker_decode fits the light: its correlation
+ *                      with a dark pulse peaks where the light is equally dark at both ends of the pulse
+ *
+ * Usage: scope_synth [--duration S] [--clock-ppm P] [--delay-us D] [--jitter-ns J] [--noise N]
+ *                    [--unlocked S] [--pps-offset S] [--seed N]
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "scope_block.h"
+#include "shutter_waveform.h"
+
+const double CPU_HZ = 16e6;                           // Nominal clock of the oscilloscope
+const uint16_t PAIR_CYCLES = 800;                     // 20000 sample pairs per second, as in oscilloscope.ino
+const double PPS_LEVEL = 675;                         // A0 during the GPS pulse, 3.3 V
+const double PPS_SECONDS = 0.1;                       // Length of the GPS pulse
+const double LIGHT_LEVEL = 900;                       // A1 with the shutter open
+const double DARK_LEVEL = 100;                        // A1 with the shutter shut
+const double FALL_SECONDS = 200e-6;                   // Time constant of the falling light
+const double RISE_SECONDS = 800e-6;                   // Time constant of the rising light, slower in the liquid crystal
+
+struct Options {
+  double duration = 600;
+  double clockPpm = 777;
+  double delayUs = 150;
+  double jitterNs = 0;
+  double noise = 2;                                   // RMS ADC noise in ADC units
+  double unlocked = 5;
+  double ppsOffset = 0.3137;
+  unsigned seed = 1;
+};
+
+struct Shutter {
+  const Options &opt;
+  std::mt19937 rng;
+  std::normal_distribution<double> jitter;
+  long second = -2;                                   // True second of the edges below
+  std::vector<double> shut;                           // Start of each dark pulse of the second, in true seconds
+  std::vector<double> open;                           // End of each dark pulse, also those that run into the next second
+
+  explicit Shutter(const Options &o) : opt(o), rng(o.seed), jitter(0, o.jitterNs * 1e-9) {}
+
+  void edges(long k)
+  {
+    second = k;
+    shut.clear();
+    open.clear();
+    // The previous second for the pulse that ends in this one, and for the recovery of the light
+    for (long s = k - 1; s <= k; s++) {
+      for (uint8_t w = 0; w < SHUTTER_HZ; w++) {
+        if (s >= opt.unlocked && (MARKER_WAVES >> w & 1)) {
+          continue;
+        }
+        double start = opt.ppsOffset + s + (w + SHUTTER_CHANNELS[0].offsetPercentage / 100.) / SHUTTER_HZ +
+          opt.delayUs * 1e-6;
+        double jitterStart = opt.jitterNs > 0 ? jitter(rng) : 0;
+        double jitterEnd = opt.jitterNs > 0 ? jitter(rng) : 0;
+        shut.push_back(start + jitterStart);
+        open.push_back(start + SHUTTER_CHANNELS[0].shutPercentage / 100. / SHUTTER_HZ + jitterEnd);
+      }
+    }
+  }
+
+  double light(double t)
+  {
+    long k = (long)floor(t - opt.ppsOffset);
+    if (k != second) {
+      edges(k);
+    }
+    // Light of the last pulse that started before t, assuming that the light recovers within a wave
+    double level = LIGHT_LEVEL;
+    for (size_t i = 0; i < shut.size(); i++) {
+      if (t < shut[i]) {
+        break;
+      }
+      if (t < open[i]) {
+        level = DARK_LEVEL + (LIGHT_LEVEL - DARK_LEVEL) * exp(-(t - shut[i]) / FALL_SECONDS);
+      } else {
+        level = LIGHT_LEVEL - (LIGHT_LEVEL - DARK_LEVEL) * exp(-(t - open[i]) / RISE_SECONDS);
+      }
+    }
+    return level;
+  }
+};
+
+static bool parseArgs(int argc, char **argv, Options &opt)
+{
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const char *arg = argv[i];
+    double value = atof(argv[i + 1]);
+    if (!strcmp(arg, "--duration")) {
+      opt.duration = value;
+    } else if (!strcmp(arg, "--clock-ppm")) {
+      opt.clockPpm = value;
+    } else if (!strcmp(arg, "--delay-us")) {
+      opt.delayUs = value;
+    } else if (!strcmp(arg, "--jitter-ns")) {
+      opt.jitterNs = value;
+    } else if (!strcmp(arg, "--noise")) {
+      opt.noise = value;
+    } else if (!strcmp(arg, "--unlocked")) {
+      opt.unlocked = value;
+    } else if (!strcmp(arg, "--pps-offset")) {
+      opt.ppsOffset = value;
+    } else if (!strcmp(arg, "--seed")) {
+      opt.seed = (unsigned)value;
+    } else {
+      return false;
+    }
+  }
+  return argc % 2 == 1 && opt.duration > 0 && opt.ppsOffset >= 0 && opt.ppsOffset < 1;
+}
+
+int main(int argc, char **argv)
+{
+  Options opt;
+  if (!parseArgs(argc, argv, opt)) {
+    fprintf(stderr, "Usage: scope_synth [--duration S] [--clock-ppm P] [--delay-us D] [--jitter-ns J] [--noise N]\n"
+      "                   [--unlocked S] [--pps-offset S] [--seed N]\n");
+    return 2;
+  }
+  double pairSeconds = PAIR_CYCLES / (CPU_HZ * (1 + opt.clockPpm * 1e-6));
+  fprintf(stderr, "pairs_per_second %.6f\n", 1 / pairSeconds);
+  fprintf(stderr, "first_marker_s %.7f\n", opt.ppsOffset + ceil(opt.unlocked));
+  double fallingUs = opt.delayUs + FALL_SECONDS * log(2) * 1e6;
+  double shutUs = SHUTTER_CHANNELS[0].shutPercentage * 1e4 / SHUTTER_HZ;
+  fprintf(stderr, "falling_us %.1f\n", fallingUs);
+  fprintf(stderr, "rising_us %.1f\n", opt.delayUs + shutUs + RISE_SECONDS * log(2) * 1e6);
+  // Bisection of 1 - exp(-x / FALL_SECONDS) = exp(-x / RISE_SECONDS), the darkness at the start of the
+  // pattern pulse, x after the start of the dark pulse, and at its end, x after the end of the dark pulse
+  double lo = 0, hi = RISE_SECONDS;
+  for (int i = 0; i < 50; i++) {
+    double x = (lo + hi) / 2;
+    (1 - exp(-x / FALL_SECONDS) < exp(-x / RISE_SECONDS) ? lo : hi) = x;
+  }
+  fprintf(stderr, "marker_us %.1f\n", opt.delayUs + lo * 1e6);
+
+  Shutter shutter(opt);
+  std::mt19937 rng(opt.seed + 1);
+  std::normal_distribution<double> noise(0, opt.noise);
+  auto adc = [&](double value) { return (uint16_t)std::max(0L, std::min(1023L, lround(value + noise(rng)))); };
+  printf("Fast sampling of A0 and A1, pairs per second: 20000\r\n");
+  uint8_t block[BLOCK_SIZE];
+  uint8_t seq = 0;
+  long pairs = (long)(opt.duration / pairSeconds);
+  for (long first = 0; first < pairs; first += BLOCK_PAIRS) {
+    encodeBlockHeader(block, seq++, first, PAIR_CYCLES);
+    for (uint8_t i = 0; i < BLOCK_PAIRS; i++) {
+      double t = (first + i) * pairSeconds;
+      double s = t - opt.ppsOffset;
+      double pps = s >= 0 && s - floor(s) < PPS_SECONDS ? PPS_LEVEL : 0;
+      packPair(block + BLOCK_HEADER + 3 * i, adc(pps), adc(shutter.light(t + pairSeconds / 2)));
+    }
+    block[BLOCK_SIZE - 1] = blockChecksum(block);
+    fwrite(block, 1, BLOCK_SIZE, stdout);
+  }
+  return 0;
+}
@@ -0,0 +1,582 @@
+/*
+ * Cycle-level model of the ATmega328P peripherals used by the shutter firmware:
+ * TIMER1 (normal and CTC mode, compare units A and B with their output pins, input capture), PORTD, the INT0 external interrupt, the TIMER0 based
+ * micros()/millis() time keeping, the hardware UART, the EEPROM, an SD card and the idle sleep mode.
+ */
+#include "avr_sim.h"
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <random>
+
+namespace sim {
+
+uint64_t cycle = 0;
+Costs costs;
+Hooks hooks;
+uint8_t eeprom[EEPROM_SIZE] = {};
+SdCard sdCard;
+
+const uint64_t NEVER = std::numeric_limits<uint64_t>::max();
+const int SERIAL_BUFFER = 64;                         // Transmit and receive buffer size of the Arduino HardwareSerial
+const uint8_t OCF1A_BIT = 1 << 1;                     // TIFR1 bit for compare match A
+const uint8_t ICF1_BIT = 1 << 5;                      // TIFR1 bit for input capture
+const uint8_t OCIE1A_BIT = 1 << 1;                    // TIMSK1 bit for compare match A
+const uint8_t ICIE1_BIT = 1 << 5;                     // TIMSK1 bit for input capture
+const uint8_t WGM12_BIT = 1 << 3;                     // TCCR1B bit for CTC mode
+const uint8_t ICNC1_BIT = 1 << 7;                     // TCCR1B bit for the input capture noise canceler
+const uint8_t COM1A_SHIFT = 6;                        // TCCR1A position of the compare output mode bits of unit A
+const uint8_t COM1B_SHIFT = 4;                        // TCCR1A position of the compare output mode bits of unit B
+const uint8_t OC1A_BIT = 1 << 1;                      // OC1A on PB1 (D9)
+const uint8_t OC1B_BIT = 1 << 2;                      // OC1B on PB2 (D10)
+const unsigned NOISE_CANCELER_CYCLES = 4;             // Extra capture delay with the noise canceler enabled
+const uint64_t EEPROM_WRITE_CYCLES = 54400;           // 3.4 ms erase and write of one EEPROM byte, busy-waited by avr-libc
+const uint64_t SD_TRANSFER_CYCLES = 20480;            // 512 bytes over SPI at 4 MHz with the SdFat byte loop, 2.5 us per byte
+const uint64_t SD_BUSY_CYCLES = 8000;                 // Typical busy time of the card after a sector write, 0.5 ms
+const unsigned SD_SLOW_ONE_IN = 32;                   // One in so many writes the card is busy erasing flash
+const uint64_t SD_SLOW_CYCLES = 1280000;              // Up to 80 ms busy time for erasing flash
+
+// CPU state
+static bool iFlag = false;                            // Global interrupt enable flag in SREG
+static bool inIsr = false;                            // ISRs do not nest in this model
+static uint64_t activity = 0;                         // Main code writes and ISRs, for skipping idle loop() iterations
+static bool isrSinceSei = false;                      // An interrupt was serviced since interrupts were last enabled
+static bool asleep = false;                           // In sleep_cpu(), the next interrupt pays costs.wakeup
+static uint64_t sleptCycles = 0;
+static std::mt19937_64 rng;
+static unsigned long isrCounts[IRQ_COUNT];
+
+// Register file for registers without side effects
+static unsigned regs[REG_COUNT];
+
+// TIMER1 state: the counter has value t1Value at timer tick t1Tick (tick = cycle / prescaler)
+static unsigned prescaler = 0;
+static uint16_t t1Value = 0;
+static uint64_t t1Tick = 0;
+static bool t1Blocked = false;                        // A TCNT1 write blocks a compare match on the next timer clock
+static uint8_t ocPins = 0;                            // Output compare registers OC1A and OC1B, bits as in PORTB
+
+// INT0 and input capture state, both pins receive the PPS signal
+static void (*int0Handler)() = nullptr;
+static bool int0Flag = false;
+static std::deque<uint64_t> ppsQueue;
+
+// UART state
+static uint64_t byteCycles = 0;                       // 0 while Serial.begin() was not called
+static uint64_t txBusyUntil = 0;                      // Cycle at which the last queued byte leaves the UART
+static std::deque<std::pair<uint64_t, uint8_t>> rxQueue;  // Bytes on the RX pin with the cycle of their stop bit
+static std::deque<uint8_t> rxBuffer;                  // Receive buffer of HardwareSerial
+
+static unsigned prescalerFromTccr1b(unsigned tccr1b)
+{
+  static const unsigned values[8] = {0, 1, 8, 64, 256, 1024, 0, 0};  // 6 and 7 are external clock sources
+  return values[tccr1b & 0x07];
+}
+
+// Timer tick at which the counter passes a compare match with the given compare register
+static uint64_t compareTick(uint16_t ocr)
+{
+  if (prescaler == 0) {
+    return NEVER;
+  }
+  uint64_t distance;
+  if (t1Value < ocr || (t1Value == ocr && !t1Blocked)) {
+    distance = ocr - t1Value;
+  } else {
+    distance = 0x10000 - t1Value + ocr;               // Runs up to 0xFFFF, wraps and counts up to OCR1A
+  }
+  return t1Tick + distance + 1;
+}
+
+// Compare output action of the non-PWM modes (COM1x1:0 = toggle, clear or set) on one output compare register
+static uint8_t compareOutput(uint8_t pins, unsigned com, uint8_t bit)
+{
+  switch (com & 0x03) {
+  case 1:
+    return pins ^ bit;
+  case 2:
+    return pins & ~bit;
+  case 3:
+    return pins | bit;
+  }
+  return pins;
+}
+
+// The pins follow the output compare registers if their compare output mode is set and they are outputs
+static uint8_t ocOutputs(uint8_t pins)
+{
+  uint8_t enabled = 0;
+  if (regs[REG_TCCR1A] >> COM1A_SHIFT & 0x03) {
+    enabled |= OC1A_BIT;
+  }
+  if (regs[REG_TCCR1A] >> COM1B_SHIFT & 0x03) {
+    enabled |= OC1B_BIT;
+  }
+  return pins & enabled & regs[REG_DDRB];
+}
+
+static void syncTimer(uint64_t atCycle)
+{
+  if (prescaler == 0) {
+    return;
+  }
+  uint64_t now = atCycle / prescaler;
+  bool ctc = regs[REG_TCCR1B] & WGM12_BIT;
+  bool outputB = regs[REG_TCCR1A] >> COM1B_SHIFT & 0x03;   // Compare unit B only matters for its output pin
+  for (;;) {
+    uint64_t tickA = compareTick(regs[REG_OCR1A]);
+    uint64_t tickB = outputB ? compareTick(regs[REG_OCR1B]) : NEVER;
+    if (ctc && tickB > tickA) {
+      tickB = NEVER;                                  // The counter clears before it reaches OCR1B
+    }
+    uint64_t tick = std::min(tickA, tickB);
+    if (tick > now) {
+      break;
+    }
+    uint8_t pins = ocPins;
+    if (tickB == tick) {
+      pins = compareOutput(pins, regs[REG_TCCR1A] >> COM1B_SHIFT, OC1B_BIT);
+    }
+    if (tickA == tick) {
+      pins = compareOutput(pins, regs[REG_TCCR1A] >> COM1A_SHIFT, OC1A_BIT);
+      regs[REG_TIFR1] |= OCF1A_BIT;
+      t1Value = ctc ? 0 : (uint16_t)(regs[REG_OCR1A] + 1);
+    } else {
+      t1Value = (uint16_t)(regs[REG_OCR1B] + 1);
+    }
+    t1Tick = tick;
+    t1Blocked = false;
+    if (hooks.outputCompare && ocOutputs(pins) != ocOutputs(ocPins)) {
+      hooks.outputCompare(tick * prescaler, ocOutputs(ocPins), ocOutputs(pins));
+    }
+    ocPins = pins;
+  }
+  if (now > t1Tick) {
+    t1Value = (uint16_t)(t1Value + (now - t1Tick));
+    t1Tick = now;
+    t1Blocked = false;
+  }
+}
+
+static void syncPps(uint64_t atCycle)
+{
+  while (!ppsQueue.empty() && ppsQueue.front() <= atCycle) {
+    uint64_t edge = ppsQueue.front();
+    ppsQueue.pop_front();
+    int0Flag = true;
+    if (prescaler) {
+      syncTimer(edge + (regs[REG_TCCR1B] & ICNC1_BIT ? NOISE_CANCELER_CYCLES : 0));
+      regs[REG_ICR1] = t1Value;
+      regs[REG_TIFR1] |= ICF1_BIT;
+    }
+  }
+}
+
+// Bring all peripherals up to date, in the order of their events
+static void syncAll(uint64_t atCycle)
+{
+  syncPps(atCycle);
+  syncTimer(atCycle);
+}
+
+static uint64_t nextEventCycle()
+{
+  uint64_t next = NEVER;
+  if (!ppsQueue.empty() && (int0Handler || (regs[REG_TIMSK1] & ICIE1_BIT))) {
+    next = ppsQueue.front();
+  }
+  if (regs[REG_TIMSK1] & OCIE1A_BIT) {
+    uint64_t tick = compareTick(regs[REG_OCR1A]);
+    if (tick != NEVER && tick * prescaler < next) {
+      next = tick * prescaler;
+    }
+  }
+  if (!rxQueue.empty() && byteCycles && rxQueue.front().first < next) {
+    next = rxQueue.front().first;
+  }
+  return next;
+}
+
+static void runIsr(Irq irq)
+{
+  inIsr = true;
+  iFlag = false;
+  cycle += costs.isrEntry + rng() % (costs.isrEntryJitter + 1);
+  if (asleep) {
+    cycle += costs.wakeup;
+    asleep = false;
+  }
+  isrSinceSei = true;
+  isrCounts[irq]++;
+  activity++;
+  if (irq == IRQ_INT0) {
+    int0Handler();
+  } else if (irq == IRQ_TIMER1_CAPT) {
+    TIMER1_CAPT_vect();
+  } else if (irq == IRQ_TIMER1_COMPA) {
+    TIMER1_COMPA_vect();
+  } else {
+    cycle += costs.serialRxIsr;
+  }
+  cycle += costs.isrExit;
+  iFlag = true;
+  inIsr = false;
+}
+
+// Dispatch all pending and enabled interrupts at the current cycle, in vector priority order
+static void service()
+{
+  while (iFlag && !inIsr) {
+    syncAll(cycle);
+    if (int0Flag && int0Handler) {
+      int0Flag = false;
+      runIsr(IRQ_INT0);
+    } else if ((regs[REG_TIFR1] & ICF1_BIT) && (regs[REG_TIMSK1] & ICIE1_BIT) && TIMER1_CAPT_vect) {
+      regs[REG_TIFR1] &= ~ICF1_BIT;
+      runIsr(IRQ_TIMER1_CAPT);
+    } else if ((regs[REG_TIFR1] & OCF1A_BIT) && (regs[REG_TIMSK1] & OCIE1A_BIT)) {
+      regs[REG_TIFR1] &= ~OCF1A_BIT;
+      runIsr(IRQ_TIMER1_COMPA);
+    } else if (!rxQueue.empty() && byteCycles && rxQueue.front().first <= cycle) {
+      // HardwareSerial drops a received byte when its buffer is full
+      if (rxBuffer.size() < SERIAL_BUFFER - 1) {
+        rxBuffer.push_back(rxQueue.front().second);
+      }
+      rxQueue.pop_front();
+      runIsr(IRQ_USART_RX);
+    } else {
+      break;
+    }
+  }
+}
+
+void advance(uint64_t n)
+{
+  uint64_t target = cycle + n;
+  while (iFlag && !inIsr) {
+    uint64_t next = nextEventCycle();
+    if (next > target) {
+      break;
+    }
+    if (next > cycle) {
+      cycle = next;
+    }
+    uint64_t start = cycle;
+    service();
+    target += cycle - start;                          // Time spent in ISRs is stolen from the main code
+  }
+  if (target > cycle) {
+    cycle = target;
+  }
+  service();
+}
+
+unsigned readRegister(RegId id)
+{
+  advance(costs.access);
+  syncAll(cycle);
+  if (id == REG_TCNT1) {
+    return t1Value;
+  }
+  return regs[id];
+}
+
+void writeRegister(RegId id, unsigned value)
+{
+  advance(costs.access);
+  if (!inIsr) {
+    activity++;
+  }
+  syncAll(cycle);
+  switch (id) {
+  case REG_TCNT1:
+    t1Value = value;
+    t1Tick = prescaler ? cycle / prescaler : 0;
+    t1Blocked = true;
+    break;
+  case REG_TCCR1B:
+    regs[id] = value & 0xFF;
+    prescaler = prescalerFromTccr1b(value);
+    t1Tick = prescaler ? cycle / prescaler : 0;
+    break;
+  case REG_TIFR1:
+    regs[id] &= ~value;                               // Flags are cleared by writing a logical one
+    break;
+  case REG_PORTD:
+    if (hooks.portWrite && (uint8_t)regs[id] != (uint8_t)value) {
+      hooks.portWrite(cycle, regs[id], value);
+    }
+    regs[id] = value & 0xFF;
+    break;
+  case REG_OCR1A:
+  case REG_OCR1B:
+  case REG_ICR1:
+    regs[id] = value & 0xFFFF;
+    break;
+  default:
+    regs[id] = value & 0xFF;
+  }
+  service();
+}
+
+void interruptsEnable(bool enable)
+{
+  iFlag = enable;
+  if (enable) {
+    isrSinceSei = false;
+    service();
+  }
+}
+
+void sleepCpu()
+{
+  // The instruction after sei() runs before a pending interrupt, so sei() followed by sleep_cpu() goes
+  // to sleep and wakes up right away when an interrupt was pending; service() has then already run it
+  if (!iFlag || inIsr || isrSinceSei) {
+    return;
+  }
+  uint64_t next = nextEventCycle();
+  if (next == NEVER) {
+    return;
+  }
+  // The TIMER0 overflow, which wakes the MCU every 1024 microseconds, is not modelled: like an idle loop()
+  // iteration, the firmware only goes back to sleep after it
+  if (next > cycle) {
+    sleptCycles += next - cycle;
+    cycle = next;
+  }
+  asleep = true;
+  service();
+  asleep = false;
+}
+
+uint64_t sleepCycles()
+{
+  return sleptCycles;
+}
+
+void attachExternal(uint8_t interruptNum, void (*handler)(), int mode)
+{
+  (void)mode;                                         // The scenario only generates rising edges
+  if (interruptNum == 0) {
+    int0Handler = handler;
+    int0Flag = false;
+  }
+}
+
+uint32_t microsNow()
+{
+  uint32_t us = (uint32_t)(cycle / 64 * 4);          // TIMER0 at prescaler 64: 4 microsecond resolution
+  advance(costs.micros);
+  return us;
+}
+
+uint32_t millisNow()
+{
+  uint32_t ms = (uint32_t)(cycle / 16000);
+  advance(costs.micros);
+  return ms;
+}
+
+void delayCycles(uint64_t n, unsigned long us)
+{
+  if (!inIsr) {
+    activity++;
+  }
+  if (hooks.delayCall) {
+    hooks.delayCall(cycle, us);
+  }
+  advance(n);
+}
+
+uint8_t eepromRead(unsigned address)
+{
+  advance(costs.access);
+  return eeprom[address % EEPROM_SIZE];
+}
+
+void eepromWrite(unsigned address, uint8_t value)
+{
+  if (!inIsr) {
+    activity++;
+  }
+  advance(EEPROM_WRITE_CYCLES);
+  eeprom[address % EEPROM_SIZE] = value;
+}
+
+bool sdWriteSector(uint32_t sector, const uint8_t *data)
+{
+  if (!inIsr) {
+    activity++;
+  }
+  if (!sdCard.present || sector < sdCard.fileSector) {
+    return false;
+  }
+  // SPI transfers are polled by the main code, interrupts are serviced in between
+  uint64_t busy = SD_BUSY_CYCLES + rng() % SD_BUSY_CYCLES;
+  if (rng() % SD_SLOW_ONE_IN == 0) {
+    busy += rng() % SD_SLOW_CYCLES;
+  }
+  advance(SD_TRANSFER_CYCLES + busy);
+  size_t offset = (size_t)(sector - sdCard.fileSector) * SD_SECTOR_BYTES;
+  if (sdCard.file.size() < offset + SD_SECTOR_BYTES) {
+    sdCard.file.resize(offset + SD_SECTOR_BYTES, 0xFF);
+  }
+  memcpy(&sdCard.file[offset], data, SD_SECTOR_BYTES);
+  return true;
+}
+
+void serialBegin(unsigned long baud)
+{
+  byteCycles = 16000000ULL * 10 / baud;               // 8N1 framing: 10 bits per byte
+  txBusyUntil = cycle;
+}
+
+void serialWrite(uint8_t c)
+{
+  if (!inIsr) {
+    activity++;
+  }
+  if (byteCycles == 0) {
+    return;
+  }
+  // Block while the transmit buffer is full, like HardwareSerial::write() does
+  uint64_t bufferEnd = cycle + SERIAL_BUFFER * byteCycles;
+  if (txBusyUntil > bufferEnd) {
+    advance(txBusyUntil - bufferEnd);
+  }
+  txBusyUntil = (txBusyUntil > cycle ? txBusyUntil : cycle) + byteCycles;
+  advance(costs.access);
+  if (hooks.serialByte) {
+    hooks.serialByte(cycle, c);
+  }
+}
+
+int serialAvailableForWrite()
+{
+  advance(costs.access);
+  if (byteCycles == 0 || txBusyUntil <= cycle) {
+    return SERIAL_BUFFER - 1;
+  }
+  // The byte being shifted out of the UART is no longer in the transmit buffer
+  int queued = (txBusyUntil - cycle + byteCycles - 1) / byteCycles;
+  return std::max(SERIAL_BUFFER - queued, 0);
+}
+
+int serialAvailable()
+{
+  advance(costs.access);
+  return rxBuffer.size();
+}
+
+int serialRead()
+{
+  advance(costs.access);
+  if (rxBuffer.empty()) {
+    return -1;
+  }
+  activity++;
+  uint8_t c = rxBuffer.front();
+  rxBuffer.pop_front();
+  return c;
+}
+
+void reset(uint64_t seed)
+{
+  cycle = 0;
+  iFlag = true;                                       // Arduino init() enables interrupts before setup()
+  inIsr = false;
+  activity = 0;
+  isrSinceSei = false;
+  asleep = false;
+  sleptCycles = 0;
+  rng.seed(seed);
+  for (unsigned &r : regs) {
+    r = 0;
+  }
+  for (unsigned long &n : isrCounts) {
+    n = 0;
+  }
+  prescaler = 0;
+  t1Value = 0;
+  t1Tick = 0;
+  t1Blocked = false;
+  ocPins = 0;
+  int0Handler = nullptr;
+  int0Flag = false;
+  ppsQueue.clear();
+  byteCycles = 0;
+  txBusyUntil = 0;
+  rxQueue.clear();
+  rxBuffer.clear();
+}
+
+void schedulePps(uint64_t atCycle)
+{
+  ppsQueue.push_back(atCycle);
+}
+
+void scheduleSerialRx(uint64_t atCycle, const void *data, size_t size)
+{
+  // The receiver uses the baud rate of Serial.begin(), bytes before that are lost
+  for (size_t i = 0; i < size && byteCycles; i++) {
+    rxQueue.push_back({atCycle + (i + 1) * byteCycles, ((const uint8_t *)data)[i]});
+  }
+}
+
+void runLoop(void (*loopFn)(), uint64_t untilCycle)
+{
+  while (cycle < untilCycle) {
+    uint64_t before = activity;
+    loopFn();
+    advance(costs.loopOverhead);
+    if (activity == before) {
+      // An iteration without output and without interrupts leaves the state unchanged, so
+      // skip ahead to the next interrupt, arriving at a random point of a loop() iteration
+      uint64_t next = nextEventCycle();
+      if (next > untilCycle) {
+        next = untilCycle;
+      }
+      if (next > cycle) {
+        advance(next - cycle + rng() % (costs.loopOverhead + 1));
+      }
+    }
+  }
+}
+
+unsigned long isrCount(Irq irq)
+{
+  return isrCounts[irq];
+}
+
+// The firmware is compiled with a 32-bit long (see include/arduino.h), so "%lu" receives an int
+int formatAvr(char *buffer, size_t size, const char *format, ...)
+{
+  char hostFormat[256];
+  size_t j = 0;
+  bool inSpec = false;
+  for (size_t i = 0; format[i] && j < sizeof(hostFormat) - 1; i++) {
+    char c = format[i];
+    if (inSpec && c == 'l') {
+      continue;
+    }
+    if (c == '%') {
+      inSpec = !inSpec;
+    } else if (inSpec && strchr("diouxXcsfeEgGp", c)) {
+      inSpec = false;
+    }
+    hostFormat[j++] = c;
+  }
+  hostFormat[j] = 0;
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(buffer, size, hostFormat, args);
+  va_end(args);
+  return n;
+}
+
+}  // namespace sim
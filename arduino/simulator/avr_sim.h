@@ -0,0 +1,100 @@
+/*
+ * Simulated ATmega328P environment for running the shutter firmware on a Linux host.
+ *
+ * Time is kept in MCU clock cycles since reset. Every access of the firmware to a simulated
+ * peripheral (registers, micros(), Serial) advances the cycle counter by a configurable cost and
+ * dispatches the interrupts that became due in the meantime. This gives interrupts the same
+ * opportunities to preempt the main code as on the real board, with a granularity of one access.
+ * The mapping from MCU cycles to true (GPS) time is owned by the scenario code in simulator.cpp.
+ */
+#ifndef AVR_SIM_H
+#define AVR_SIM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace sim {
+
+// Register identifiers of the simulated peripherals
+enum RegId {
+  REG_TCCR1A, REG_TCCR1B, REG_TIMSK1, REG_TIFR1, REG_TCNT1, REG_OCR1A, REG_OCR1B, REG_ICR1, REG_PORTD, REG_DDRD,
+  REG_DDRB,
+  REG_COUNT
+};
+
+// Interrupt sources in AVR vector priority order (lower value wins)
+enum Irq { IRQ_INT0, IRQ_TIMER1_CAPT, IRQ_TIMER1_COMPA, IRQ_USART_RX, IRQ_COUNT };
+
+// Cost model, in MCU cycles
+struct Costs {
+  unsigned access = 32;           // Average cost of a peripheral access including the code around it
+  unsigned micros = 64;           // Cost of the Arduino micros() call
+  unsigned isrEntry = 24;         // Vector jump plus ISR prologue, before the first statement executes
+  unsigned isrEntryJitter = 4;    // Uniform extra latency for finishing the interrupted instruction
+  unsigned isrExit = 20;          // ISR epilogue and reti
+  unsigned loopOverhead = 32;     // Arduino main() overhead per loop() iteration
+  unsigned serialRxIsr = 40;      // Body of the UART receive ISR of HardwareSerial, storing one byte
+  unsigned wakeup = 4;            // Extra interrupt response when the interrupt wakes the MCU from sleep
+};
+
+// Observation hooks for the scenario code (all optional)
+struct Hooks {
+  std::function<void(uint64_t cycle, uint8_t oldPortd, uint8_t newPortd)> portWrite;
+  std::function<void(uint64_t cycle, uint8_t oldPins, uint8_t newPins)> outputCompare;  // OC1A and OC1B as bits 1 and 2 of PORTB
+  std::function<void(uint64_t cycle, uint8_t c)> serialByte;
+  std::function<void(uint64_t cycle, unsigned long us)> delayCall;
+};
+
+const unsigned EEPROM_SIZE = 1024;
+const unsigned SD_SECTOR_BYTES = 512;
+
+// SD card with one preallocated file, for the SD_LOG option of the firmware
+struct SdCard {
+  bool present = false;
+  uint32_t fileSector = 8192;     // First sector of the file on the card
+  std::vector<uint8_t> file;      // Contents of the file, grown by the sector writes
+};
+
+extern uint64_t cycle;            // MCU clock cycles since reset
+extern uint8_t eeprom[EEPROM_SIZE];   // Survives reset(), the scenario code erases (0xFF) or loads it
+extern SdCard sdCard;
+extern Costs costs;
+extern Hooks hooks;
+
+// Firmware-facing API, used by the shim headers
+unsigned readRegister(RegId id);
+void writeRegister(RegId id, unsigned value);
+void interruptsEnable(bool enable);
+void attachExternal(uint8_t interruptNum, void (*handler)(), int mode);
+uint32_t microsNow();
+uint32_t millisNow();
+void delayCycles(uint64_t n, unsigned long us);
+void sleepCpu();                              // Idle sleep up to the next interrupt, with interrupts enabled
+void serialBegin(unsigned long baud);
+void serialWrite(uint8_t c);
+int serialAvailableForWrite();
+int serialAvailable();
+int serialRead();
+uint8_t eepromRead(unsigned address);
+void eepromWrite(unsigned address, uint8_t value);
+bool sdWriteSector(uint32_t sector, const uint8_t *data);
+int formatAvr(char *buffer, size_t size, const char *format, ...);
+
+// Scenario-facing API
+void reset(uint64_t seed);
+void schedulePps(uint64_t atCycle);           // Rising edge on the INT0 and ICP1 pins at the given cycle
+void scheduleSerialRx(uint64_t atCycle, const void *data, size_t size);  // Bytes on the RX pin from the given cycle on
+void advance(uint64_t n);                     // Let n cycles of main code pass, servicing interrupts
+void runLoop(void (*loopFn)(), uint64_t untilCycle);
+unsigned long isrCount(Irq irq);
+uint64_t sleepCycles();                       // Cycles spent in sleep_cpu() since reset()
+
+}  // namespace sim
+
+// Interrupt vectors implemented by the firmware, optional ones are weak
+extern "C" void TIMER1_COMPA_vect(void);
+extern "C" void TIMER1_CAPT_vect(void) __attribute__((weak));
+
+#endif
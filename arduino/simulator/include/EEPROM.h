@@ -0,0 +1,37 @@
+/*
+ * Host replacement for the EEPROM library of the Arduino AVR core, backed by the simulated EEPROM of
+ * avr_sim.h. Like the original, put() only writes the bytes that change.
+ */
+#ifndef SIM_EEPROM_H
+#define SIM_EEPROM_H
+
+#include "arduino.h"
+
+struct EEPROMClass {
+  uint8_t read(int idx) { return sim::eepromRead(idx); }
+  void write(int idx, uint8_t val) { sim::eepromWrite(idx, val); }
+  void update(int idx, uint8_t val) { if (read(idx) != val) write(idx, val); }
+  uint16_t length() { return sim::EEPROM_SIZE; }
+
+  template <typename T> T &get(int idx, T &t)
+  {
+    uint8_t *ptr = (uint8_t *)&t;
+    for (size_t i = 0; i < sizeof(T); i++) {
+      ptr[i] = read(idx + i);
+    }
+    return t;
+  }
+
+  template <typename T> const T &put(int idx, const T &t)
+  {
+    const uint8_t *ptr = (const uint8_t *)&t;
+    for (size_t i = 0; i < sizeof(T); i++) {
+      update(idx + i, ptr[i]);
+    }
+    return t;
+  }
+};
+
+inline EEPROMClass EEPROM;
+
+#endif
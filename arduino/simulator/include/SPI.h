@@ -0,0 +1,10 @@
+/*
+ * Host replacement for the SPI library of the Arduino AVR core. The simulated SD card of SdFat.h
+ * does not go through it.
+ */
+#ifndef SIM_SPI_H
+#define SIM_SPI_H
+
+#include "arduino.h"
+
+#endif
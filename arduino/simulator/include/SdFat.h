@@ -0,0 +1,58 @@
+/*
+ * Host replacement for the part of the SdFat library (version 2) that the SD_LOG option of the
+ * firmware uses: creating one contiguous, preallocated file and raw sector writes to it. The card
+ * and the file are simulated by sim::sdCard of avr_sim.h.
+ */
+#ifndef SIM_SDFAT_H
+#define SIM_SDFAT_H
+
+#include "arduino.h"
+
+#define SD_SCK_MHZ(maxMhz) (1000000UL * (maxMhz))
+#define SHARED_SPI 0
+#define DEDICATED_SPI 1
+#define O_RDWR 0x02
+#define O_CREAT 0x40
+
+struct SdSpiConfig {
+  SdSpiConfig(uint8_t csPin, uint8_t options, uint32_t maxSck) {}
+};
+
+class SdSpiCard {
+public:
+  bool begin(SdSpiConfig config) { return sim::sdCard.present; }
+  bool writeSector(uint32_t sector, const uint8_t *src) { return sim::sdWriteSector(sector, src); }
+};
+
+class File32 {
+public:
+  bool open(const char *path, int oflag) { isOpen = sim::sdCard.present; return isOpen; }
+  bool preAllocate(uint32_t length) { size = length; return isOpen; }
+  bool contiguousRange(uint32_t *bgnSector, uint32_t *endSector)
+  {
+    *bgnSector = sim::sdCard.fileSector;
+    *endSector = sim::sdCard.fileSector + (size + sim::SD_SECTOR_BYTES - 1) / sim::SD_SECTOR_BYTES - 1;
+    return isOpen && size > 0;
+  }
+  bool close() { isOpen = false; return true; }
+  explicit operator bool() { return isOpen; }
+
+private:
+  bool isOpen = false;
+  uint32_t size = 0;
+};
+
+class SdFat32 {
+public:
+  bool begin(SdSpiConfig config) { return sim::sdCard.present; }
+  bool exists(const char *path) { return false; }   // Every simulation starts with an empty card
+  void end() {}
+  uint8_t *cacheClear() { return cache; }            // The sector cache of the volume, for raw sector access
+  SdSpiCard *card() { return &spiCard; }
+
+private:
+  uint8_t cache[sim::SD_SECTOR_BYTES];
+  SdSpiCard spiCard;
+};
+
+#endif
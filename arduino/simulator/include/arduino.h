@@ -0,0 +1,160 @@
+/*
+ * Host replacement for the Arduino core and avr-libc headers, so that the firmware sources compile
+ * unchanged against the simulated ATmega328P of avr_sim.h.
+ *
+ * The AVR data model has a 32-bit long. The firmware relies on that for the micros() overflow
+ * arithmetic, so this header ends with redefining long as int. Therefore, all host headers that the
+ * firmware or other shim headers may need are included here first.
+ */
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+#include <cmath>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "avr_sim.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+#define F(string_literal) (string_literal)
+#define abs(x) ((x)>0?(x):-(x))
+#define min(a,b) ((a)<(b)?(a):(b))
+#define max(a,b) ((a)>(b)?(a):(b))
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+#define digitalPinToInterrupt(p) ((p) == 2 ? 0 : ((p) == 3 ? 1 : -1))
+
+// Register access routed through the simulator, so that reads and writes have timing side effects
+template <typename T, sim::RegId ID>
+struct SimRegister {
+  operator T() const { return (T)sim::readRegister(ID); }
+  SimRegister &operator=(unsigned value) { sim::writeRegister(ID, (T)value); return *this; }
+  SimRegister &operator|=(unsigned value) { return *this = (T)*this | value; }
+  SimRegister &operator&=(unsigned value) { return *this = (T)*this & value; }
+};
+
+inline SimRegister<uint8_t, sim::REG_TCCR1A> TCCR1A;
+inline SimRegister<uint8_t, sim::REG_TCCR1B> TCCR1B;
+inline SimRegister<uint8_t, sim::REG_TIMSK1> TIMSK1;
+inline SimRegister<uint8_t, sim::REG_TIFR1> TIFR1;
+inline SimRegister<uint16_t, sim::REG_TCNT1> TCNT1;
+inline SimRegister<uint16_t, sim::REG_OCR1A> OCR1A;
+inline SimRegister<uint16_t, sim::REG_OCR1B> OCR1B;
+inline SimRegister<uint16_t, sim::REG_ICR1> ICR1;
+inline SimRegister<uint8_t, sim::REG_PORTD> PORTD;
+inline SimRegister<uint8_t, sim::REG_DDRD> DDRD;
+inline SimRegister<uint8_t, sim::REG_DDRB> DDRB;
+
+// Bit positions from avr/iom328p.h
+#define WGM10 0
+#define WGM11 1
+#define COM1B0 4
+#define COM1B1 5
+#define COM1A0 6
+#define COM1A1 7
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define WGM12 3
+#define WGM13 4
+#define ICES1 6
+#define ICNC1 7
+#define TOIE1 0
+#define OCIE1A 1
+#define OCIE1B 2
+#define ICIE1 5
+#define TOV1 0
+#define OCF1A 1
+#define OCF1B 2
+#define ICF1 5
+
+#define ISR(vector, ...) extern "C" void vector(void)
+
+inline void cli() { sim::interruptsEnable(false); }
+inline void sei() { sim::interruptsEnable(true); }
+inline void noInterrupts() { cli(); }
+inline void interrupts() { sei(); }
+
+inline unsigned long micros() { return sim::microsNow(); }
+inline unsigned long millis() { return sim::millisNow(); }
+inline void delayMicroseconds(unsigned int us) { sim::delayCycles(16ULL * us, us); }
+inline void delay(unsigned long ms) { sim::delayCycles(16000ULL * ms, 1000 * ms); }
+
+inline void attachInterrupt(uint8_t interruptNum, void (*handler)(), int mode)
+{
+  sim::attachExternal(interruptNum, handler, mode);
+}
+
+inline void pinMode(uint8_t pin, uint8_t mode)
+{
+  if (pin < 8) {
+    DDRD = mode == OUTPUT ? (DDRD | (1 << pin)) : (DDRD & ~(1 << pin));
+  } else if (pin < 14) {
+    DDRB = mode == OUTPUT ? (DDRB | (1 << (pin - 8))) : (DDRB & ~(1 << (pin - 8)));
+  }
+}
+
+inline void digitalWrite(uint8_t pin, uint8_t value)
+{
+  if (pin < 8) {
+    PORTD = value ? (PORTD | (1 << pin)) : (PORTD & ~(1 << pin));
+  }
+}
+
+#define SERIAL_TX_BUFFER_SIZE 64
+
+class HardwareSerial {
+public:
+  void begin(unsigned long baud) { sim::serialBegin(baud); }
+  int available() { return sim::serialAvailable(); }
+  int read() { return sim::serialRead(); }
+  int availableForWrite() { return sim::serialAvailableForWrite(); }
+  void flush() {}
+  size_t write(uint8_t c) { sim::serialWrite(c); return 1; }
+  size_t print(const char *text) { size_t n = 0; while (text[n]) write(text[n++]); return n; }
+  size_t print(char c) { return write(c); }
+  size_t print(long n) { char b[24]; snprintf(b, sizeof(b), "%ld", n); return print(b); }
+  size_t print(unsigned long n) { char b[24]; snprintf(b, sizeof(b), "%lu", n); return print(b); }
+  size_t print(int n) { return print((long)n); }
+  size_t print(unsigned int n) { return print((unsigned long)n); }
+  size_t println() { return print("\r\n"); }
+  template <typename T> size_t println(T value) { return print(value) + println(); }
+  explicit operator bool() { return true; }
+};
+
+inline HardwareSerial Serial;
+
+// The firmware passes register values to snprintf(), which needs an explicit conversion here
+namespace sim {
+template <typename T> inline T vararg(T value) { return value; }
+template <typename T, RegId ID> inline unsigned vararg(SimRegister<T, ID> reg) { return (T)reg; }
+}
+
+template <typename... Args>
+inline int sim_snprintf(char *buffer, size_t size, const char *format, Args... args)
+{
+  return sim::formatAvr(buffer, size, format, sim::vararg(args)...);
+}
+
+#define snprintf sim_snprintf
+// Strings in flash, like F(): the host has a single address space, so these are the plain strings
+#define PSTR(text) (text)
+#define snprintf_P sim_snprintf
+// long gets the 32 bits of the AVR; int cannot get its 16 bits on the host, see "Limits" in doc/simulator.md
+#define long int
+
+#endif
@@ -0,0 +1,17 @@
+/*
+ * Host replacement for <avr/sleep.h>. Only the idle mode is modelled: sleep_cpu() lets the cycles pass up
+ * to the next interrupt of the simulation (see sim::sleepCpu()).
+ */
+#ifndef SIM_AVR_SLEEP_H
+#define SIM_AVR_SLEEP_H
+
+#include "../arduino.h"
+
+#define SLEEP_MODE_IDLE 0
+
+inline void set_sleep_mode(uint8_t mode) { (void)mode; }
+inline void sleep_enable() {}
+inline void sleep_disable() {}
+inline void sleep_cpu() { sim::sleepCpu(); }
+
+#endif
@@ -0,0 +1,45 @@
+#!/bin/sh
+# Runs the scenarios of scenarios.txt (see doc/simulator.md), writes a report per scenario and the combined
+# build/scenarios/report.json, and exits with status 1 if any scenario fails.
+#
+#   ./run_scenarios.sh [NAME...]    only the named scenarios
+
+cd "$(dirname "$0")" || exit 1
+out=build/scenarios
+mkdir -p $out
+failed=0
+combined=$out/report.json
+printf '[' > $combined
+sep=''
+while read -r name options; do
+  case "$name" in
+    ''|'#'*) continue ;;
+  esac
+  if [ $# -gt 0 ] && ! echo " $* " | grep -q " $name "; then
+    continue
+  fi
+  rm -f $out/$name.json
+  # The SD card needs the firmware with SD_LOG enabled
+  case " $options " in
+    *' --sd '*) simulator=./simulator-sd ;;
+    *) simulator=./simulator ;;
+  esac
+  # The options hold no quotes or spaces within an argument, so word splitting is fine here
+  if $simulator $options --report $out/$name.json > $out/$name.log 2>&1; then
+    echo "PASS $name"
+  else
+    echo "FAIL $name (see $out/$name.log)"
+    grep -E '^(Expectation failed|Unknown KPI)' $out/$name.log | sed 's/^/     /'
+    failed=1
+  fi
+  printf '%s\n{"scenario": "%s", "report":\n' "$sep" "$name" >> $combined
+  if [ -f $out/$name.json ]; then
+    cat $out/$name.json >> $combined
+  else
+    echo null >> $combined
+  fi
+  printf '}' >> $combined
+  sep=','
+done < scenarios.txt
+printf '\n]\n' >> $combined
+exit $failed
@@ -0,0 +1,652 @@
+/*
+ * Host-side simulator for the waveform-h-bridge sketch.
+ *
+ * Runs the unchanged firmware sources against the simulated ATmega328P of avr_sim.cpp, with an MCU
+ * clock that deviates from its nominal 16 MHz and a GPS PPS signal with timing jitter. The output
+ * edges on PORTD or on the TIMER1 output compare pins are compared with the ideal waveform of shutter_waveform.h, as defined by true
+ * GPS time, which gives the phase error per second without an oscilloscope.
+ *
+ * Usage: see printUsage() below or doc/simulator.md.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "avr_sim.h"
+#include "shutter_waveform.h"
+#include "telemetry.h"
+
+// Sketch entrypoints from waveform-h-bridge.ino
+void setup();
+void loop();
+
+const double MCU_HZ = 16e6;                           // Nominal MCU clock
+const uint8_t OC1A_BIT = 1 << 1;                      // PIN_POS of the sketch with OUTPUT_COMPARE, on PORTB
+const uint8_t OC1B_BIT = 1 << 2;                      // PIN_NEG of the sketch with OUTPUT_COMPARE, on PORTB
+const int N_WAVE = SHUTTER_HZ;                        // Expected shutter frequency
+const int SETTLE_SECONDS = 10;                        // Settling of the clock discipline after the first lock
+const unsigned ALL_SLOTS = N_WAVE == 32 ? 0xFFFFFFFFu : (1u << N_WAVE) - 1;
+
+// Limit on a KPI of the summary, e.g. "lock_losses<=0" (see kpis() below)
+struct Expectation {
+  std::string kpi;
+  std::string op;                                     // "<=", ">=" or "=="
+  double value;
+};
+
+struct Options {
+  double duration = 3600;                             // Seconds of true time
+  double clockPpm = 800;                              // MCU clock error, a typical value from doc/waveform_log.md
+  double driftPpmPerHour = 0;                         // Linear change of the MCU clock error, e.g. by temperature
+  double jitterNs = 30;                               // RMS of the PPS timing error
+  double qErrNs = 0;                                  // Amplitude of the sawtooth quantization error of the PPS edges
+  int gpsDelay = 2;                                   // Seconds before the first PPS arrives
+  std::vector<std::pair<size_t, size_t>> dropouts;    // First second and number of seconds without PPS
+  double spuriousPerHour = 0;                         // Rate of extra edges at random moments on the PPS pin
+  uint64_t seed = 1;
+  bool echo = false;                                  // Echo the serial output of the firmware
+  const char *csvPath = nullptr;                      // Per-second records
+  const char *eepromPath = nullptr;                   // EEPROM image, loaded at start and saved at the end
+  const char *serialPath = nullptr;                   // Raw serial output, e.g. for the telemetry decoder
+  const char *sdPath = nullptr;                       // Log file on the simulated SD card, saved at the end
+  time_t nmeaStart = 0;                               // UTC at the start of the simulation for NMEA sentences, 0 for none
+  std::vector<std::pair<size_t, std::string>> sends;  // Second and text sent to the UART, e.g. a serial command
+  const char *reportPath = nullptr;                   // KPIs and expectations as JSON
+  std::vector<Expectation> expects;
+  std::string commandLine;                            // Options as given, for the report
+};
+
+// Mapping between true time and MCU cycles, with the MCU frequency constant within each true second
+struct Clock {
+  const Options &opt;
+  std::vector<double> cycleAt = {0.};                 // MCU cycle at the start of each true second
+  std::vector<double> freq;                           // MCU frequency during each true second
+
+  explicit Clock(const Options &o) : opt(o) {}
+
+  void extend(size_t second)
+  {
+    while (freq.size() <= second) {
+      double hours = (freq.size() + 0.5) / 3600.;
+      double ppm = opt.clockPpm + opt.driftPpmPerHour * hours;
+      freq.push_back(MCU_HZ * (1. + ppm * 1e-6));
+      cycleAt.push_back(cycleAt.back() + freq.back());
+    }
+  }
+
+  double trueTime(uint64_t cycle) const
+  {
+    size_t k = std::upper_bound(cycleAt.begin(), cycleAt.end(), (double)cycle) - cycleAt.begin() - 1;
+    k = std::min(k, freq.size() - 1);
+    return k + (cycle - cycleAt[k]) / freq[k];
+  }
+};
+
+// Observations within one true second, for each channel of SHUTTER_CHANNELS
+struct Second {
+  unsigned slots[N_CHANNEL] = {};                     // Bit j set: shut edge observed near j/N_WAVE s plus the phase offset
+  double maxAbsErr = 0;                               // Largest edge error of all channels in microseconds
+  double lastErr[N_CHANNEL];                          // Error of the last edge of the pulse train
+  int avoidances = 0;
+  int lockLosses = 0;
+
+  Second() { std::fill(lastErr, lastErr + N_CHANNEL, NAN); }
+  bool marker() const                                 // All edges present except at the markers, on all channels
+  {
+    return std::all_of(slots, slots + N_CHANNEL, [](unsigned s) { return s == (ALL_SLOTS & ~MARKER_WAVES); });
+  }
+};
+
+static void printUsage()
+{
+  printf(
+    "Usage: simulator [options]\n"
+    "  --duration T        simulated time, in seconds or with suffix m, h or d (default 1h)\n"
+    "  --clock-ppm P       MCU clock error in ppm (default 800)\n"
+    "  --drift P           change of the MCU clock error in ppm per hour (default 0)\n"
+    "  --jitter-ns J       RMS jitter of the PPS edges in ns (default 30)\n"
+    "  --qerr-ns Q         sawtooth quantization error of the PPS edges up to Q ns, reported by UBX TIM-TP (default 0)\n"
+    "  --gps-delay S       seconds before the first PPS (default 2)\n"
+    "  --dropout S:L       no PPS during L seconds from second S (repeatable)\n"
+    "  --spurious R        extra PPS edges at random moments, R per hour on average (default 0)\n"
+    "  --seed N            random seed (default 1)\n"
+    "  --access-cycles N   cost of a peripheral access in MCU cycles (default 32)\n"
+    "  --csv FILE          write one record per simulated second\n"
+    "  --eeprom FILE       load the EEPROM from FILE if it exists and save it there at the end\n"
+    "  --serial FILE       write the raw serial output of the firmware to FILE\n"
+    "  --sd FILE           insert an SD card and save the log file of the firmware (SD_LOG) to FILE\n"
+    "  --nmea UTC          send RMC and ZDA sentences to the UART (GPS_TIME), starting at UTC YYYY-MM-DDThh:mm:ss\n"
+    "  --send S:TEXT       send TEXT to the UART in the middle of second S, e.g. p for the PROFILER dump (repeatable)\n"
+    "  --echo              echo the serial output of the firmware\n"
+    "  --report FILE       write the KPIs of the summary and the results of the expectations as JSON\n"
+    "  --expect KPI<=V     fail (exit status 1) unless the KPI meets the limit, also >= and == (repeatable)\n");
+}
+
+// KPI of the summary for the report and the expectations, printed with the given decimals
+struct Kpi {
+  const char *name;
+  double value;
+  int decimals;
+};
+
+// Writes the report and checks the expectations, returns the exit status
+static int checkKpis(const Options &opt, const Kpi *kpis, size_t n)
+{
+  FILE *report = nullptr;
+  if (opt.reportPath && !(report = fopen(opt.reportPath, "w"))) {
+    perror(opt.reportPath);
+    return 1;
+  }
+  if (report) {
+    std::string options;
+    for (char c : opt.commandLine) {
+      options += c == '"' || c == '\\' ? std::string("\\") + c : std::string(1, c);
+    }
+    fprintf(report, "{\n  \"options\": \"%s\",\n  \"kpis\": {\n", options.c_str());
+    for (size_t i = 0; i < n; i++) {
+      fprintf(report, "    \"%s\": %.*f%s\n", kpis[i].name, kpis[i].decimals, kpis[i].value, i + 1 < n ? "," : "");
+    }
+    fprintf(report, "  },\n  \"expectations\": [");
+  }
+  bool pass = true;
+  for (size_t j = 0; j < opt.expects.size(); j++) {
+    const Expectation &e = opt.expects[j];
+    const Kpi *kpi = std::find_if(kpis, kpis + n, [&](const Kpi &k) { return e.kpi == k.name; });
+    if (kpi == kpis + n) {
+      printf("Unknown KPI: %s\n", e.kpi.c_str());
+      pass = false;
+      continue;
+    }
+    bool met = e.op == "<=" ? kpi->value <= e.value : e.op == ">=" ? kpi->value >= e.value : kpi->value == e.value;
+    if (!met) {
+      printf("Expectation failed: %s = %.*f, expected %s %g\n", kpi->name, kpi->decimals, kpi->value, e.op.c_str(),
+        e.value);
+      pass = false;
+    }
+    if (report) {
+      fprintf(report, "%s\n    {\"kpi\": \"%s\", \"op\": \"%s\", \"limit\": %g, \"pass\": %s}", j ? "," : "",
+        kpi->name, e.op.c_str(), e.value, met ? "true" : "false");
+    }
+  }
+  if (report) {
+    fprintf(report, "%s],\n  \"pass\": %s\n}\n", opt.expects.empty() ? "" : "\n  ", pass ? "true" : "false");
+    fclose(report);
+  }
+  return pass ? 0 : 1;
+}
+
+// NMEA sentence with checksum and line end
+static std::string nmeaSentence(const char *body)
+{
+  uint8_t checksum = 0;
+  for (const char *c = body; *c; c++) {
+    checksum ^= *c;
+  }
+  char text[128];
+  snprintf(text, sizeof(text), "$%s*%02X\r\n", body, checksum);
+  return text;
+}
+
+// RMC and ZDA sentences of a GPS receiver for the second that starts with a PPS, or an RMC sentence
+// without time before the receiver has the time
+static std::string nmeaSentences(time_t utc, bool fix)
+{
+  char body[128];
+  if (utc == 0) {
+    return nmeaSentence("GNRMC,,V,,,,,,,,,,N");
+  }
+  struct tm t;
+  gmtime_r(&utc, &t);
+  snprintf(body, sizeof(body), "GNRMC,%02d%02d%02d.00,%c,5213.00000,N,00507.00000,E,0.010,,%02d%02d%02d,,,%c",
+    t.tm_hour, t.tm_min, t.tm_sec, fix ? 'A' : 'V', t.tm_mday, t.tm_mon + 1, t.tm_year % 100, fix ? 'A' : 'N');
+  std::string text = nmeaSentence(body);
+  snprintf(body, sizeof(body), "GNZDA,%02d%02d%02d.00,%02d,%02d,%04d,00,00", t.tm_hour, t.tm_min, t.tm_sec,
+    t.tm_mday, t.tm_mon + 1, t.tm_year + 1900);
+  return text + nmeaSentence(body);
+}
+
+// UBX message with sync bytes and checksum
+static std::vector<uint8_t> ubxMessage(uint8_t msgClass, uint8_t msgId, const std::vector<uint8_t> &payload)
+{
+  std::vector<uint8_t> message = {0xB5, 0x62, msgClass, msgId, (uint8_t)payload.size(), (uint8_t)(payload.size() >> 8)};
+  for (uint8_t b : payload) {
+    message.push_back(b);
+  }
+  uint8_t ckA = 0, ckB = 0;
+  for (size_t i = 2; i < message.size(); i++) {
+    ckA += message[i];
+    ckB += ckA;
+  }
+  message.push_back(ckA);
+  message.push_back(ckB);
+  return message;
+}
+
+// UBX TIM-TP message announcing the quantization error of the next PPS
+static std::vector<uint8_t> timTpMessage(double qErr)
+{
+  std::vector<uint8_t> payload(16, 0);
+  int32_t ps = (int32_t)lround(qErr * 1e12);
+  for (int i = 0; i < 4; i++) {
+    payload[8 + i] = (uint8_t)(ps >> (8 * i));
+  }
+  payload[14] = 0x03;                                 // flags: UTC time base, UTC available
+  return ubxMessage(0x0D, 0x01, payload);
+}
+
+static double parseDuration(const char *text)
+{
+  char *end;
+  double value = strtod(text, &end);
+  switch (*end) {
+  case 'm': return value * 60;
+  case 'h': return value * 3600;
+  case 'd': return value * 86400;
+  default: return value;
+  }
+}
+
+static bool parseExpectation(const char *text, Expectation &e)
+{
+  const char *op = strpbrk(text, "<>=");
+  if (!op || op == text || op[1] != '=' || !op[2]) {
+    return false;
+  }
+  char *end;
+  e.kpi.assign(text, op);
+  e.op.assign(op, 2);
+  e.value = strtod(op + 2, &end);
+  return !*end;
+}
+
+static bool parseOptions(int argc, char **argv, Options &opt)
+{
+  for (int i = 1; i < argc; i++) {
+    opt.commandLine += (i > 1 ? " " : "") + std::string(argv[i]);
+  }
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!strcmp(arg, "--echo")) {
+      opt.echo = true;
+      continue;
+    }
+    if (!val) {
+      return false;
+    }
+    i++;
+    if (!strcmp(arg, "--duration")) {
+      opt.duration = parseDuration(val);
+    } else if (!strcmp(arg, "--clock-ppm")) {
+      opt.clockPpm = atof(val);
+    } else if (!strcmp(arg, "--drift")) {
+      opt.driftPpmPerHour = atof(val);
+    } else if (!strcmp(arg, "--jitter-ns")) {
+      opt.jitterNs = atof(val);
+    } else if (!strcmp(arg, "--qerr-ns")) {
+      opt.qErrNs = atof(val);
+    } else if (!strcmp(arg, "--gps-delay")) {
+      opt.gpsDelay = atoi(val);
+    } else if (!strcmp(arg, "--dropout")) {
+      size_t start, length;
+      if (sscanf(val, "%zu:%zu", &start, &length) != 2) {
+        return false;
+      }
+      opt.dropouts.push_back({start, length});
+    } else if (!strcmp(arg, "--spurious")) {
+      opt.spuriousPerHour = atof(val);
+    } else if (!strcmp(arg, "--seed")) {
+      opt.seed = strtoull(val, nullptr, 10);
+    } else if (!strcmp(arg, "--access-cycles")) {
+      sim::costs.access = atoi(val);
+    } else if (!strcmp(arg, "--csv")) {
+      opt.csvPath = val;
+    } else if (!strcmp(arg, "--eeprom")) {
+      opt.eepromPath = val;
+    } else if (!strcmp(arg, "--serial")) {
+      opt.serialPath = val;
+    } else if (!strcmp(arg, "--sd")) {
+      opt.sdPath = val;
+    } else if (!strcmp(arg, "--nmea")) {
+      struct tm utc = {};
+      if (sscanf(val, "%d-%d-%dT%d:%d:%d", &utc.tm_year, &utc.tm_mon, &utc.tm_mday, &utc.tm_hour, &utc.tm_min,
+          &utc.tm_sec) != 6) {
+        return false;
+      }
+      utc.tm_year -= 1900;
+      utc.tm_mon -= 1;
+      opt.nmeaStart = timegm(&utc);
+    } else if (!strcmp(arg, "--send")) {
+      const char *text = strchr(val, ':');
+      if (!text) {
+        return false;
+      }
+      opt.sends.push_back({(size_t)atol(val), text + 1});
+    } else if (!strcmp(arg, "--report")) {
+      opt.reportPath = val;
+    } else if (!strcmp(arg, "--expect")) {
+      Expectation e;
+      if (!parseExpectation(val, e)) {
+        return false;
+      }
+      opt.expects.push_back(e);
+    } else {
+      return false;
+    }
+  }
+  return opt.duration > 0;
+}
+
+int main(int argc, char **argv)
+{
+  Options opt;
+  if (!parseOptions(argc, argv, opt)) {
+    printUsage();
+    return 2;
+  }
+  FILE *csv = nullptr;
+  if (opt.csvPath) {
+    csv = fopen(opt.csvPath, "w");
+    if (!csv) {
+      perror(opt.csvPath);
+      return 1;
+    }
+    fprintf(csv, "second,edges,marker,last_edge_error_us,max_abs_error_us,avoidances,lock_losses\n");
+  }
+  FILE *serial = nullptr;
+  if (opt.serialPath) {
+    serial = fopen(opt.serialPath, "wb");
+    if (!serial) {
+      perror(opt.serialPath);
+      return 1;
+    }
+  }
+
+  // Power cycles keep the EEPROM contents, a new board has an erased EEPROM
+  memset(sim::eeprom, 0xFF, sizeof(sim::eeprom));
+  if (opt.eepromPath) {
+    if (FILE *f = fopen(opt.eepromPath, "rb")) {
+      if (fread(sim::eeprom, 1, sizeof(sim::eeprom), f) != sizeof(sim::eeprom)) {
+        memset(sim::eeprom, 0xFF, sizeof(sim::eeprom));
+      }
+      fclose(f);
+    }
+  }
+
+  sim::sdCard.present = opt.sdPath != nullptr;
+  sim::sdCard.file.clear();
+
+  size_t nSecond = (size_t)opt.duration;
+  Clock clock(opt);
+  clock.extend(nSecond);
+  std::vector<Second> seconds(nSecond + 1);
+  std::mt19937_64 rng(opt.seed);
+  std::normal_distribution<double> jitter(0., opt.jitterNs * 1e-9);
+
+  auto secondAt = [&](uint64_t cycle) -> Second & {
+    size_t k = (size_t)clock.trueTime(cycle);
+    return seconds[std::min(k, nSecond)];
+  };
+  // PIN_NEG and PIN_POS of each channel on PORTD
+  uint8_t negBits[N_CHANNEL], posBits[N_CHANNEL];
+  for (int c = 0; c < N_CHANNEL; c++) {
+    negBits[c] = 1 << SHUTTER_CHANNELS[c].pinNeg;
+    posBits[c] = 1 << SHUTTER_CHANNELS[c].pinPos;
+  }
+  auto pinEdge = [&](uint64_t cycle, int c, uint8_t oldPins, uint8_t newPins) {
+    if (newPins == oldPins || (newPins != negBits[c] && newPins != posBits[c])) {
+      return;                                         // Only edges that put a voltage on the shutter
+    }
+    double t = clock.trueTime(cycle) - SHUTTER_CHANNELS[c].offsetPercentage / 100. / N_WAVE;
+    double k = floor(t);
+    int slot = (int)lround((t - k) * N_WAVE);
+    double err = (t - k - (double)slot / N_WAVE) * 1e6;
+    if (slot == N_WAVE) {
+      slot = 0;
+      k += 1;
+    }
+    Second &sec = seconds[std::min((size_t)k, nSecond)];
+    sec.slots[c] |= 1u << slot;
+    sec.maxAbsErr = std::max(sec.maxAbsErr, fabs(err));
+    if (slot == N_WAVE - 1) {
+      sec.lastErr[c] = err;
+    }
+  };
+  sim::hooks.portWrite = [&](uint64_t cycle, uint8_t oldPortd, uint8_t newPortd) {
+    for (int c = 0; c < N_CHANNEL; c++) {
+      uint8_t mask = negBits[c] | posBits[c];
+      pinEdge(cycle, c, oldPortd & mask, newPortd & mask);
+    }
+  };
+  // With OUTPUT_COMPARE the sketch drives PIN_NEG and PIN_POS of its only channel from TIMER1 instead of PORTD
+  auto ocToPins = [&](uint8_t oc) -> uint8_t {
+    return (oc & OC1A_BIT ? posBits[0] : 0) | (oc & OC1B_BIT ? negBits[0] : 0);
+  };
+  sim::hooks.outputCompare = [&](uint64_t cycle, uint8_t oldPins, uint8_t newPins) {
+    pinEdge(cycle, 0, ocToPins(oldPins), ocToPins(newPins));
+  };
+  // The serial output mixes log text with binary telemetry frames, the decoder turns both into log text
+  TelemetryDecoder decoder;
+  size_t nUtcChecked = 0, nUtcWrong = 0;
+  // Calibration records saved to the EEPROM, against the mean MCU frequency since the previous one
+  size_t nSaved = 0;
+  double savedErrorPpm = 0;
+  uint64_t savedCycle = 0;
+  // The receiver sends TIM-TP after the firmware enabled it with CFG-MSG
+  const std::vector<uint8_t> enableTimTp = ubxMessage(0x06, 0x01, {0x0D, 0x01, 0x01});
+  size_t nEnableTimTp = 0;
+  bool timTp = false;
+  sim::hooks.serialByte = [&](uint64_t cycle, uint8_t c) {
+    if (serial) {
+      fputc(c, serial);
+    }
+    nEnableTimTp = c == enableTimTp[nEnableTimTp] ? nEnableTimTp + 1 : c == enableTimTp[0];
+    if (nEnableTimTp == enableTimTp.size()) {
+      timTp = true;
+      nEnableTimTp = 0;
+    }
+    if (!decoder.push(c)) {
+      return;
+    }
+    if (strstr(decoder.line, "Lock with GPS signal lost")) {
+      secondAt(cycle).lockLosses++;
+    }
+    unsigned long savedFreq;
+    if (sscanf(decoder.line, "Saved MCU: %lu", &savedFreq) == 1) {
+      double freq = (cycle - savedCycle) / (clock.trueTime(cycle) - clock.trueTime(savedCycle));
+      savedErrorPpm = std::max(savedErrorPpm, fabs(savedFreq / freq - 1) * 1e6);
+      savedCycle = cycle;
+      nSaved++;
+    }
+    // The UTC records are sent in the second of the GPS pulse that they describe
+    struct tm utc = {};
+    if (opt.nmeaStart && sscanf(decoder.line, "UTC: %d-%d-%d %d:%d:%d", &utc.tm_year, &utc.tm_mon, &utc.tm_mday,
+        &utc.tm_hour, &utc.tm_min, &utc.tm_sec) == 6) {
+      utc.tm_year -= 1900;
+      utc.tm_mon -= 1;
+      nUtcChecked++;
+      nUtcWrong += timegm(&utc) != opt.nmeaStart + (time_t)clock.trueTime(cycle);
+    }
+    if (opt.echo) {
+      for (char *line = strtok(decoder.line, "\n"); line; line = strtok(nullptr, "\n")) {
+        printf("%12.6f -> %s\n", clock.trueTime(cycle), line);
+      }
+    }
+  };
+  sim::hooks.delayCall = [&](uint64_t cycle, unsigned long us) {
+    (void)us;                                         // The firmware only delays for avoiding TIMER1 updates
+    secondAt(cycle).avoidances++;
+  };
+
+  auto wallStart = std::chrono::steady_clock::now();
+  sim::reset(opt.seed);
+  setup();
+  // Each PPS edge is scheduled one second ahead, because runLoop() may end slightly after its deadline
+  std::uniform_real_distribution<double> uniform(0., 1.);
+  auto schedulePps = [&](size_t k) {
+    if (k >= nSecond) {
+      return;
+    }
+    bool dropped = (int)k < opt.gpsDelay;
+    for (const auto &dropout : opt.dropouts) {
+      dropped |= k >= dropout.first && k < dropout.first + dropout.second;
+    }
+    // The receiver aligns the PPS to its own clock, which drifts against GPS time: a sawtooth error
+    double qErr = opt.qErrNs * 1e-9 * (2 * fmod(k * 0.3, 1.) - 1);
+    if (!dropped) {
+      if (timTp) {
+        std::vector<uint8_t> message = timTpMessage(qErr);
+        sim::scheduleSerialRx((uint64_t)(clock.cycleAt[k] - 0.4 * clock.freq[k]), message.data(), message.size());
+      }
+      sim::schedulePps((uint64_t)(clock.cycleAt[k] + (jitter(rng) + qErr) * clock.freq[k]));
+    }
+    // The receiver sends the time of a second 50 to 150 ms after its PPS, also without a fix
+    if (opt.nmeaStart) {
+      std::string text = nmeaSentences((int)k < opt.gpsDelay ? 0 : opt.nmeaStart + k, !dropped);
+      sim::scheduleSerialRx((uint64_t)(clock.cycleAt[k] + (0.05 + 0.1 * uniform(rng)) * clock.freq[k]), text.data(),
+        text.size());
+    }
+    for (const auto &send : opt.sends) {
+      if (send.first == k) {
+        sim::scheduleSerialRx((uint64_t)(clock.cycleAt[k] + 0.5 * clock.freq[k]), send.second.data(), send.second.size());
+      }
+    }
+    if (uniform(rng) < opt.spuriousPerHour / 3600) {
+      sim::schedulePps((uint64_t)(clock.cycleAt[k] + (0.01 + 0.98 * uniform(rng)) * clock.freq[k]));
+    }
+  };
+  schedulePps(0);
+  for (size_t k = 0; k < nSecond; k++) {
+    schedulePps(k + 1);
+    sim::runLoop(loop, (uint64_t)clock.cycleAt[k + 1]);
+  }
+  double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+  if (opt.sdPath) {
+    FILE *f = fopen(opt.sdPath, "wb");
+    if (!f || fwrite(sim::sdCard.file.data(), 1, sim::sdCard.file.size(), f) != sim::sdCard.file.size()) {
+      perror(opt.sdPath);
+    }
+    if (f) {
+      fclose(f);
+    }
+  }
+  if (opt.eepromPath) {
+    FILE *f = fopen(opt.eepromPath, "wb");
+    if (!f || fwrite(sim::eeprom, 1, sizeof(sim::eeprom), f) != sizeof(sim::eeprom)) {
+      perror(opt.eepromPath);
+    }
+    if (f) {
+      fclose(f);
+    }
+  }
+
+  // Summary over the seconds with a second marker, the locked state of the firmware
+  std::vector<bool> locked(nSecond);
+  long firstMarker = -1;
+  size_t nLocked = 0, nLast = 0;
+  int avoidances = 0;
+  int lockLosses = 0;
+  double worstLast = 0, sumLast = 0, maxAbs = 0;
+  double worstSettled = 0;                            // worstLast from SETTLE_SECONDS after the first marker on
+  for (size_t k = 0; k < nSecond; k++) {
+    const Second &sec = seconds[k];
+    avoidances += sec.avoidances;
+    lockLosses += sec.lockLosses;
+    if (csv) {
+      fprintf(csv, "%zu,%d,%d,%.3f,%.3f,%d,%d\n", k, __builtin_popcount(sec.slots[0]), sec.marker(),
+        sec.lastErr[0], sec.maxAbsErr, sec.avoidances, sec.lockLosses);
+    }
+    // Before the first PPS the pulse train runs free from wherever setup() started it, so a missing first
+    // edge there is no second marker
+    if (!sec.marker() || (int)k < opt.gpsDelay) {
+      continue;
+    }
+    if (firstMarker < 0) {
+      firstMarker = k;
+    }
+    locked[k] = true;
+    nLocked++;
+    for (int c = 0; c < N_CHANNEL; c++) {
+      nLast++;
+      sumLast += sec.lastErr[c];
+      if (fabs(sec.lastErr[c]) > fabs(worstLast)) {
+        worstLast = sec.lastErr[c];
+      }
+      if ((long)k >= firstMarker + SETTLE_SECONDS && fabs(sec.lastErr[c]) > fabs(worstSettled)) {
+        worstSettled = sec.lastErr[c];
+      }
+    }
+    maxAbs = std::max(maxAbs, sec.maxAbsErr);
+  }
+  // Recovery: seconds from the end of a dropout up to the next locked second, to the end if there is none
+  size_t recovery = 0, longestUnlocked = 0, unlocked = 0;
+  for (const auto &dropout : opt.dropouts) {
+    size_t k = std::min(dropout.first + dropout.second, nSecond);
+    while (k < nSecond && !locked[k]) {
+      k++;
+    }
+    recovery = std::max(recovery, k - std::min(dropout.first + dropout.second, nSecond));
+  }
+  for (size_t k = firstMarker < 0 ? nSecond : firstMarker; k < nSecond; k++) {
+    unlocked = locked[k] ? 0 : unlocked + 1;
+    longestUnlocked = std::max(longestUnlocked, unlocked);
+  }
+  if (csv) {
+    fclose(csv);
+  }
+  if (serial) {
+    fclose(serial);
+  }
+
+  printf("Simulated: %zu s (%.1f h) in %.2f s wall time (%.0fx real time)\n",
+    nSecond, nSecond / 3600., wallSeconds, nSecond / std::max(wallSeconds, 1e-9));
+  printf("MCU clock: %+.1f ppm, drift %+.2f ppm/h, PPS jitter %.0f ns rms\n",
+    opt.clockPpm, opt.driftPpmPerHour, opt.jitterNs);
+  printf("First second marker: %ld s\n", firstMarker);
+  printf("Locked seconds: %zu of %zu\n", nLocked, nSecond);
+  if (nLocked) {
+    printf("End of train phase error: mean %.1f us, worst %.1f us\n", sumLast / nLast, worstLast);
+    printf("End of train phase error from %d s after the first marker: worst %.1f us\n", SETTLE_SECONDS, worstSettled);
+    printf("Max abs edge error: %.1f us\n", maxAbs);
+  }
+  printf("Avoidance triggered: %d\n", avoidances);
+  printf("Lock losses: %d\n", lockLosses);
+  printf("Telemetry records lost: %u\n", decoder.lost);
+  if (opt.nmeaStart) {
+    printf("UTC records: %zu, wrong: %zu\n", nUtcChecked, nUtcWrong);
+  }
+  if (sim::sleepCycles()) {
+    printf("Idle sleep: %.1f%% of the time\n", 100. * sim::sleepCycles() / sim::cycle);
+  }
+  printf("ISR counts: INT0 %lu, TIMER1_CAPT %lu, TIMER1_COMPA %lu, USART_RX %lu\n", sim::isrCount(sim::IRQ_INT0),
+    sim::isrCount(sim::IRQ_TIMER1_CAPT), sim::isrCount(sim::IRQ_TIMER1_COMPA), sim::isrCount(sim::IRQ_USART_RX));
+
+  // The same numbers for the scenario suite (see scenarios.txt), without the wall time, so that a report
+  // only changes with the behavior of the firmware
+  const Kpi kpis[] = {
+    {"seconds", (double)nSecond, 0},
+    {"first_marker_s", (double)firstMarker, 0},
+    {"locked_seconds", (double)nLocked, 0},
+    {"phase_error_mean_us", nLast ? sumLast / nLast : 0, 1},
+    {"worst_phase_error_us", fabs(worstLast), 1},
+    {"settled_phase_error_us", fabs(worstSettled), 1},
+    {"max_edge_error_us", maxAbs, 1},
+    {"avoidances", (double)avoidances, 0},
+    {"lock_losses", (double)lockLosses, 0},
+    {"recovery_s", (double)recovery, 0},
+    {"longest_unlocked_s", (double)longestUnlocked, 0},
+    {"telemetry_lost", (double)decoder.lost, 0},
+    {"saved_records", (double)nSaved, 0},
+    {"saved_freq_error_ppm", savedErrorPpm, 1},
+    {"utc_wrong", (double)nUtcWrong, 0},
+    {"sd_sectors", (double)(sim::sdCard.file.size() / sim::SD_SECTOR_BYTES), 0},
+  };
+  return checkKpis(opt, kpis, sizeof(kpis) / sizeof(kpis[0]));
+}
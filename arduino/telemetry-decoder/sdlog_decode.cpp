@@ -0,0 +1,59 @@
+/*
+ * Host decoder of the SD card log of the waveform-h-bridge sketch (see sd_logger.h).
+ *
+ * Prints the records of a PHASEnnn.BIN file as CSV, one line per GPS pulse, and a summary with the
+ * worst sector write latency and the dropped records on stderr. The file is preallocated, so decoding
+ * stops at the first sector that was not written.
+ *
+ * Usage: sdlog_decode PHASE001.BIN > phase.csv
+ */
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#include "sd_logger.h"
+
+static const char *STATE_NAMES[] = {"calibrating", "locked", "holdover_end", "rejected"};
+
+int main(int argc, char **argv)
+{
+  if (argc != 2) {
+    fprintf(stderr, "Usage: sdlog_decode PHASE001.BIN\n");
+    return 2;
+  }
+  FILE *f = fopen(argv[1], "rb");
+  if (!f) {
+    perror(argv[1]);
+    return 1;
+  }
+  printf("sector,gps_pulse,gps_micros,mcu_freq,phase_ticks,state,train_isrs,utc,fix\n");
+  uint8_t sector[SD_SECTOR_SIZE];
+  SdSectorHeader header = {};
+  uint32_t nSector = 0;
+  unsigned long nRecord = 0;
+  while (fread(sector, 1, sizeof(sector), f) == sizeof(sector)) {
+    memcpy(&header, sector, sizeof(header));
+    if (header.magic != SD_MAGIC || header.sector != nSector || header.nRecords > SD_RECORDS) {
+      break;
+    }
+    for (uint8_t i = 0; i < header.nRecords; i++) {
+      SdRecord r;
+      memcpy(&r, sector + sizeof(SdSectorHeader) + i * sizeof(SdRecord), sizeof(r));
+      uint8_t state = r.state & ~SD_FIX;
+      char utc[24] = "";
+      time_t t = r.utc;
+      if (r.utc) {
+        strftime(utc, sizeof(utc), "%Y-%m-%dT%H:%M:%SZ", gmtime(&t));
+      }
+      printf("%u,%u,%u,%u,%d,%s,%u,%s,%d\n", nSector, r.gpsPulse, r.gpsMicros, r.freq, r.phaseTicks,
+        state < sizeof(STATE_NAMES) / sizeof(STATE_NAMES[0]) ? STATE_NAMES[state] : "unknown", r.trainIsrs, utc,
+        (r.state & SD_FIX) != 0);
+      nRecord++;
+    }
+    nSector++;
+  }
+  fclose(f);
+  fprintf(stderr, "Sectors: %u, records: %lu, dropped: %u, worst write latency before the last sector: %u us\n",
+    nSector, nRecord, nSector ? header.dropped : 0, nSector ? header.worstMicros : 0);
+  return 0;
+}
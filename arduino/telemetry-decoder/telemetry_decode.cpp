@@ -0,0 +1,72 @@
+/*
+ * Host decoder of the binary telemetry of the waveform-h-bridge sketch (see telemetry.h).
+ *
+ * Reads the serial output of the Arduino from a serial device or a file (default stdin) and prints
+ * the log text, in the format of the sketch versions that logged text. A serial device is set to
+ * 9600 baud raw mode first.
+ *
+ * Usage: telemetry_decode [/dev/ttyUSB0 | FILE]
+ */
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "telemetry.h"
+
+static bool setRawMode(int fd)
+{
+  termios tty;
+  if (tcgetattr(fd, &tty) != 0) {
+    return false;
+  }
+  cfmakeraw(&tty);
+  cfsetispeed(&tty, B9600);
+  cfsetospeed(&tty, B9600);
+  tty.c_cflag |= CLOCAL | CREAD;
+  return tcsetattr(fd, TCSANOW, &tty) == 0;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc > 2 || (argc == 2 && argv[1][0] == '-' && argv[1][1])) {
+    fprintf(stderr, "Usage: telemetry_decode [/dev/ttyUSB0 | FILE]\n");
+    return 2;
+  }
+  int fd = STDIN_FILENO;
+  if (argc == 2 && strcmp(argv[1], "-")) {
+    fd = open(argv[1], O_RDONLY | O_NOCTTY);
+    if (fd < 0) {
+      perror(argv[1]);
+      return 1;
+    }
+  }
+  if (isatty(fd) && !setRawMode(fd)) {
+    perror("tcsetattr");
+    return 1;
+  }
+
+  TelemetryDecoder decoder;
+  uint32_t lost = 0;
+  unsigned char buffer[256];
+  ssize_t n;
+  while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+    for (ssize_t i = 0; i < n; i++) {
+      if (!decoder.push(buffer[i])) {
+        continue;
+      }
+      if (decoder.lost != lost) {
+        printf("Telemetry lost: %u records\n", decoder.lost - lost);
+        lost = decoder.lost;
+      }
+      printf("%s\n", decoder.line);
+    }
+    fflush(stdout);
+  }
+  if (n < 0) {
+    perror("read");
+    return 1;
+  }
+  return 0;
+}
@@ -1,32 +1,80 @@
 /*
-Script for generating digital signals as input for an H-bridge driver of an LCD-shutter.
+Script for generating digital signals as input for an H-bridge driver of an LCD-shutter, or an opamp-based driver
+(OPAMP_DRIVER in shutter_waveform.h).
 The signals have a specific pattern useful for meteor photography and are synced
 to the 1 Hz GPS TIMEPULSE signal, also called PPS signal. For this, the script
 applies three mechanisms:
 1. Shortly after each GPS pulse, so during the blanking period of a 1 second cycle, a
    new train of 16 pulses is started that initially is synced very closely to the GPS
    signal.
-2. The MCU frequency is measured during a relatively long period (>= 60 seconds) with
-   the GPS pulses as an accurate reference. After that, the timing of the train of 15
-   pulses is done using this calibrated MCU frequency. This significantly improves
-   the syncing of the pulse train at the end of a cycle. Note that the Arduino clock
-   has a ceramic resonator with a frequency of 16 MHz +/- 0.5% (so, not very accurate).
+2. The MCU frequency is measured during a short period (10 seconds) with the GPS pulses
+   as an accurate reference. After that, the MCU frequency is disciplined every second
+   by a PI filter on the phase difference between the end of the pulse train and the
+   GPS pulse (see discipline()). The timing of the train of 15 pulses is done using
+   this calibrated MCU frequency. This significantly improves the syncing of the pulse
+   train at the end of a cycle, also when the MCU frequency drifts with temperature.
+   Note that the Arduino clock has a ceramic resonator with a frequency of
+   16 MHz +/- 0.5% (so, not very accurate).
 3. Timing of the train of 15 pulses is done with interrupts triggered by a hardware
-   timer of the Arduino MCU, which has a granularity of 4 microseconds. After
-   switching the outputs for 32 times during a 1 second cycle, this results in a
-   maximum phase difference with the GPS signal of 128 microseconds (after applying
-   mechanism 2). Mechanism 3 could further reduce the phase difference by varying the
-   individual durations in a train of 16 pulses such that the sum of the residuals is
-   minimal.
+   timer of the Arduino MCU, which has a granularity of 4 microseconds. With equal
+   durations for the 32 half waves, rounding the durations down to whole timer ticks
+   results in a phase difference with the GPS signal of up to 128 microseconds at the
+   end of a 1 second cycle (after applying mechanism 2). Mechanism 3 reduces the phase
+   difference by varying the individual durations in a train of 16 pulses, such that
+   the start of each wave is rounded to the nearest timer tick of its ideal moment in
+   the calibrated second (see ocr1aSchedule). With a clean GPS signal, the end of the pulse
+   train then lands within one timer tick of the next GPS pulse from about 10 seconds after
+   the lock on, once discipline() has absorbed the constant offset of the syncing (simulated
+   settled_phase_error_us, see doc/simulator.md). The first seconds after the lock, a fast
+   temperature drift and jitter of the GPS pulse add to this. The bound holds for the default
+   build; with PPS_CAPTURE the simulated error after the settling stays within two ticks, as
+   the captured timer value of the GPS pulse is rounded to whole ticks as well.
 
 Without a GPS signal the script operates in a free running mode generating 16 pulses
 per second using the calibratedFreq variable as a reference (boot value can be edited).
 
+The numbers of pulses above are those of the default shutter frequency of 16 Hz. Other shutter frequencies
+(SHUTTER_HZ), marker patterns and the driver circuit are selected at compile time in shutter_waveform.h. They
+only change the constants and tables derived from them, not the code path below.
+
+Several LCD shutters can be driven from the same GPS lock and TIMER1, each with its own driver inputs, shut percentage
+and phase offset (SHUTTER_CHANNELS in shutter_waveform.h). The edges of all channels are merged into one schedule:
+each wave is split into EDGES_PER_WAVE parts at the edges of all channels, and the code below handles these parts
+like the two half waves of a single channel, so one TIMER1 interrupt switches all channels with a single PORTD write.
+
+When GPS pulses are missing or rejected in the STABLE state, the pulse trains continue with the
+disciplined MCU frequency, including the second markers (holdover). Pulses that arrive more than
+PULSE_WINDOW ticks away from the start of a pulse train are rejected without losing the lock. The
+lock is lost when the predicted phase error of the holdover exceeds HOLDOVER_LIMIT, or after
+N_REJECT rejected pulses in successive seconds (the GPS pulse has moved).
+
+The disciplined MCU frequency is saved regularly in the EEPROM (see saveCalibration()). At the
+next boot the script starts from this stored value and enters the STABLE state after N_WARM GPS
+pulse intervals that agree with it (warm start), instead of after N_STABLE intervals.
+
 Documentation used as input for this script:
  - register settings:  https://exploreembedded.com/wiki/AVR_Timer_programming
  - interrupt settings: https://circuitdigest.com/microcontroller-projects/arduino-timer-tutorial
  - MCU clock accuracy: https://www.arrow.com/en/research-and-events/articles/oscillators-and-arduino-configurations-and-settings
 
+Optionally (PPS_CAPTURE), the GPS pulse is timestamped in hardware by the input capture unit of TIMER1, which
+also drives the pulse train. Then, the phase of the pulse train at the GPS pulse is known exactly in timer ticks
+and the phase correction does not depend on micros(), interrupt latency or a compensation for code execution time.
+This requires the GPS pulse to be connected to PIN_ICP as well (a wire between D2 and D8).
+
+Optionally (HIGH_RESOLUTION in gps_shutter_control.h), TIMER1 runs without prescaler, so that the durations of the
+half waves, the phase correction, the clock discipline and the logged ticks have a resolution of 62.5 nanoseconds
+instead of 4 microseconds. A half wave then lasts longer than the 16-bit timer can count. It is split into a first
+timer period of SEGMENT_TICKS up to twice that, followed by whole periods of SEGMENT_TICKS, which the TIMER1 interrupt
+counts down in segmentsLeft without touching the pins (see scheduleHalfWave()). Without PPS_CAPTURE, gpsIn() then
+also reads the TIMER1 value, because the 4 microsecond resolution of micros() would spoil the phase correction.
+
+Optionally (OUTPUT_COMPARE), the H-bridge inputs are connected to the output compare pins of TIMER1 instead of D3
+and D4: PIN_POS to OC1A (D9) and PIN_NEG to OC1B (D10). The compare match then sets or clears both pins in hardware,
+on the very timer clock that ends the half wave, so the edges do not depend on the interrupt latency. The TIMER1
+interrupt only arms the compare output mode in TCCR1A for the edge at the end of the timer period that it has just
+loaded (see armEdge()).
+
 The code below uses micros() for time keeping based on the MCU clock. The Arduino library uses a 32-bit
 counter for the micros() function, which overflows after about 70 minutes. Therefore, only time differences
 between successive micros() calls are used, which are always correct irrespective of any overflow that
@@ -39,67 +87,182 @@ The code below implements a state machine with the states described below (store
 |    |-> ZERO - entered when receiving the zeroth GPS pulse while being in the INIT state
 |        |
 |        |
-|--------|-> STABLE - entered when receiving GPS pulse number N_STABLE while being in the FIRST state
-|            |
-|            |
-|            |-> CALIBRATED - entered when receiving GPS pulse number N_CALIBRATE while being in the STABLE state
-|----------------|
+|--------|-> STABLE - entered when receiving GPS pulse number N_STABLE while being in the FIRST state,
+|        |   |         or pulse number N_WARM after a warm start
+|        |   |
+|        |   |<-> HOLDOVER - entered when a GPS pulse is missing or rejected, left when a GPS pulse arrives in phase
+|------------|----|
 
-In the STABLE and CALIBRATED states the pulse trains are locked to the GPS signal and the following events occur
+In the STABLE and HOLDOVER states the pulse trains are locked to the GPS signal and the following events occur
 each second (see the signal diagram in the README of the repo root):
-1. just before the GPS pulse arrives, a new pulse train has started with iHalfWave = 32. Outside the locked state
-   this would be a positive electrical voltage using POS_MASK, but in the locked state this triggers a specific
-   condition resulting in an electrical shortcut state using HIGH_MASK.
+1. just before the GPS pulse arrives, a new pulse train has started with iHalfWave = 0. Outside the locked state
+   this would be a positive electrical voltage on PIN_POS, but in the locked state portSchedule has the
+   shortcut of the driver for this half wave (see MARKER_WAVES in shutter_waveform.h).
 2. the GPS pulse arrives and sets gpsHit to true
 3. the shutter_control loop detects the gspHit state and starts correcting small phase differences by manipulating
    the value of TCNT1. Both leaving the control logic, iHalfWave should be zero.
+4. the phase difference measured at the GPS pulse updates the calibrated MCU frequency and the timer compare
+   values of the new pulse train.
 */
 #define DEBUG_LOG
 #undef DEBUG_LOG                                      // Outcomment to enable debug logging
+#define PPS_CAPTURE
+#undef PPS_CAPTURE                                    // Outcomment to timestamp the GPS pulse with TIMER1 input capture
+#define OUTPUT_COMPARE
+#undef OUTPUT_COMPARE                                 // Outcomment to drive the H-bridge from OC1A (D9) and OC1B (D10) in hardware
 
 #include <arduino.h>
+#include <EEPROM.h>
 #include "gps_shutter_control.h"
+#include "telemetry.h"
+#include "sd_logger.h"
+#include "gps_time.h"
+#include "scheduler.h"
+#include "profiler.h"
+#include "shutter_waveform.h"
+
+#if defined(PPS_CAPTURE) || defined(HIGH_RESOLUTION)
+#define TRAIN_CAPTURE                                 // The GPS pulse is timestamped with the TIMER1 value, see captureTrain()
+#endif
 
 // Constant values
 const int PIN_GPS = 2;                                // Match with hardware connection
-const int PIN_NEG = 3;                                // Match with hardware connection, odd negative pulses
-const int PIN_POS = 4;                                // Match with hardware connection, even positive pulses
-const byte NEG_MASK = (1 << 3);                       // Precalculate for fast interrupt handling
-const byte POS_MASK = (1 << 4);                       // Precalculate for fast interrupt handling
-const byte HIGH_MASK = NEG_MASK | POS_MASK;           // Additional mask for H-bridge driver
-const byte ZERO_MASK = 255 & ~NEG_MASK & ~POS_MASK;   // Precalcualte for fast interrupt handling
+const int PIN_ICP = 8;                                // Input capture pin of TIMER1, for PPS_CAPTURE only
+#ifdef OUTPUT_COMPARE
+const int PIN_NEG = 10;                               // OC1B, match with hardware connection, odd negative pulses
+const int PIN_POS = 9;                                // OC1A, match with hardware connection, even positive pulses
+const byte NEG_MASK = (1 << COM1B0);                  // Set OC1B on compare match instead of clearing it
+const byte POS_MASK = (1 << COM1A0);                  // Set OC1A on compare match instead of clearing it
+const byte CLEAR_MASK = (1 << COM1A1) | (1 << COM1B1);  // TCCR1A value that clears both pins on compare match (CTC mode)
+static_assert(N_CHANNEL == 1, "OUTPUT_COMPARE drives a single channel from OC1A and OC1B");
+struct ShutterOutputs {                               // The pins of SHUTTER_CHANNELS are not used
+  static constexpr byte neg(byte) { return NEG_MASK; }
+  static constexpr byte pos(byte) { return POS_MASK; }
+};
+#else
+struct ShutterOutputs {                               // D0 - D7 are the bits of PORTD
+  static constexpr byte neg(byte c) { return 1 << SHUTTER_CHANNELS[c].pinNeg; }
+  static constexpr byte pos(byte c) { return 1 << SHUTTER_CHANNELS[c].pinPos; }
+};
+#endif
+#ifdef OPAMP_DRIVER
+typedef Waveform<OpampDriver, ShutterOutputs, SHUTTER_HZ, MARKER_WAVES> Shutter;
+#else
+typedef Waveform<HBridgeDriver, ShutterOutputs, SHUTTER_HZ, MARKER_WAVES> Shutter;
+#endif
+#ifndef OUTPUT_COMPARE
+const byte ZERO_MASK = 255 & ~Shutter::outputs();     // Precalculate for fast interrupt handling
+#ifdef SD_LOG
+static_assert((Shutter::outputs() & (1 << SD_CS_PIN)) == 0, "SHUTTER_CHANNELS uses the chip select pin of the SD card");
+#endif
+#endif
 const int MCU_MHZ = 16;                               // From Arduino specs
-const int N_WAVE = 16;                                // The shutter frequency
-const int N_HALF_WAVE = 32;                           // Twice the shutter frequency
-const int PRESCALER = 64;                             // Prescaler value to be set for TIMER1
-const int TICK_MICROS = 4;                            // TIMER1 resolution with prescaler at 64
+const int N_WAVE = Shutter::N_WAVE;                   // The shutter frequency, see shutter_waveform.h
+const int N_HALF_WAVE = Shutter::N_HALF_WAVE;         // Parts of the pulse train between the edges of all channels, twice N_WAVE with one channel
+#ifdef HIGH_RESOLUTION
+const byte SEGMENT_SHIFT = 15;
+const unsigned int SEGMENT_TICKS = 1U << SEGMENT_SHIFT;  // TIMER1 period (2 milliseconds) for counting down the rest of a half wave
+#endif
 const int N_INIT = -1;                                // iGpsPulse value for the INIT state (no GPS pulse received)
 const int N_ZERO = 0;                                 // iGpsPulse value for the ZERO state (first GPS pulse interval started)
 const int N_STABLE = 10;                              // iGpsPulse value for the STABLE state: starting second markers (short GPS calibration interval)
-const int N_CALIBRATE = 60;                           // iGpsPulse value for the CALIBRATED state (< 4200): GPS-calibrated second markers
-const int TIMER_SAFETY = 2;                           // For being sure the duration of the pulse train < 1.000000 second
-                                                      // This is for 1 wave period, so impact = N * 16 * 4 = N * 64 microseconds
+const int N_WARM = 2;                                 // iGpsPulse value for the STABLE state after a warm start
+const long WARM_WINDOW = 40;                          // Max deviation in microseconds of a GPS pulse interval for a warm start
+#if defined(HIGH_RESOLUTION) && !defined(PPS_CAPTURE)
+const int SAFETY_MICROS = 16;                         // gpsIn() has to run after the TIMER1 interrupt at the end of the pulse train
+#else
+const int SAFETY_MICROS = 8;                          // For being sure the duration of the pulse train < 1.000000 second
+#endif
+const int TIMER_SAFETY = SAFETY_MICROS * MCU_MHZ / PRESCALER;  // The same in ticks, for the entire pulse train
+const int PI_KP_SHIFT = 1;                            // Proportional gain 1/2 of the clock discipline
+const int PI_KI_SHIFT = 2;                            // Integral gain 1/4 of the clock discipline
+const long PI_CLAMP = 256L * MCU_MHZ / PRESCALER;     // Max phase difference in ticks (256 microseconds) fed to the clock discipline (glitches)
+const long PULSE_WINDOW_MICROS = 1000;                // Max phase difference in microseconds of an accepted GPS pulse
+const long PULSE_WINDOW = PULSE_WINDOW_MICROS * MCU_MHZ / PRESCALER;  // The same in ticks
+const int N_REJECT = 3;                               // Number of successive rejected GPS pulses that end the lock
+const unsigned long HOLDOVER_LIMIT = 500;             // Max predicted phase error in microseconds during holdover
+const unsigned long HOLDOVER_PPM = 2;                 // Frequency error of the disciplined MCU clock in ppm (linear error growth)
+const unsigned long HOLDOVER_DRIFT_PPB = 10;          // Frequency drift in ppb per second, e.g. by temperature (quadratic error growth)
+const unsigned long MIN_FREQ = 15920000;              // Lowest plausible MCU frequency (16 MHz - 0.5%) for a GPS pulse interval
+const unsigned long MAX_FREQ = 16080000;              // Highest plausible MCU frequency (16 MHz + 0.5%) for a GPS pulse interval
+#ifdef HIGH_RESOLUTION
+static_assert(MAX_FREQ / N_WAVE / SEGMENT_TICKS <= 256, "segmentsLeft cannot count a wave at this shutter frequency");
+static_assert(MIN_FREQ / N_WAVE * shortestPart() / 100 > SEGMENT_TICKS, "the edges of the channels are too close together");
+#else
+static_assert(MAX_FREQ / PRESCALER / N_WAVE <= 65536, "a wave does not fit TIMER1 at this shutter frequency");
+#endif
+const byte EEPROM_SLOTS = 32;                         // Number of calibration records in the EEPROM for wear levelling
+const unsigned long N_SAVE_FIRST = 60;                // Seconds of clock discipline before the first calibration record is saved
+const unsigned long N_SAVE = 900;                     // Seconds of clock discipline between saving calibration records
+const unsigned long SD_WRITE_TICKS = 3000L * MCU_MHZ / PRESCALER;  // Min ticks (3 milliseconds) up to the next edge for an SD sector write
+const unsigned int AVOID_TICKS = 200L * MCU_MHZ / PRESCALER;  // Ticks (200 microseconds) sufficient to execute the syncing in run_shutter_control()
+const int COMPENSATION_MICROS = 48;                   // Code execution duration of the syncing, see setup_shutter_control()
+const unsigned long SD_TASK_MICROS = 100000;          // Worst-case SD sector write, the card can be busy for 80 milliseconds (SD_LOG)
+const unsigned long DRAIN_TASK_MICROS = 500;          // Worst-case drainTelemetry(), filling the transmit buffer of the UART
+const unsigned long EEPROM_TASK_MICROS = 4000;        // Worst-case eepromTask(), one EEPROM byte takes 3.4 milliseconds
+const long DEADLINE_MARGIN = 1000;                    // Microseconds between the end of a task and the earliest accepted GPS pulse
+const long NO_DEADLINE = 0x7FFFFFFF;                  // Tasks are not limited before the STABLE state
 
 // Global variables modified in interrupt routines
 volatile bool gpsHit = false;                         // Set by the gpsIn interrupt only and cleared after processing
 volatile unsigned long lastGpsMicros;                 // Set by the gpsIn interrupt only and ignored before gpsHit = true
-volatile unsigned long iHalfWave = 0;                 // Phase of shutter waveform in terms of block half waves
+volatile byte iHalfWave = 0;                          // Phase of shutter waveform in terms of block half waves (0 - N_HALF_WAVE - 1)
+#ifdef HIGH_RESOLUTION
+volatile byte segmentsLeft = 0;                       // Timer periods of SEGMENT_TICKS left in the current half wave
+#endif
 volatile unsigned long iIsr = 0;                      // For monitoring
+volatile unsigned long trainIsr = 0;                  // iIsr at the GPS pulse: half waves of the pulse train that it ended
+#ifdef TRAIN_CAPTURE
+volatile unsigned int captureTicks;                   // TIMER1 value at the GPS pulse, set by captureTrain() only
+volatile byte captureHalfWave;                        // iHalfWave at the GPS pulse, set by captureTrain() only
+#ifdef HIGH_RESOLUTION
+volatile byte captureSegments;                        // segmentsLeft at the GPS pulse, set by captureTrain() only
+#endif
+#endif
 
 // Global variables related to and depending on calibration
-int shutPercentage;                                   // Value passed to setup_shutter_control()
 int compensationTicks;                                // Code execution duration from time measurement to timer adjustment
 unsigned long calibratedFreq = 1000000 * MCU_MHZ;     // Overwritten by initial calibration after 10 GPS pulse intervals
-unsigned int waveTicks;                               // Number of ticks of 1 wave of 16 Hz (depends on auto-calibration)
-unsigned int ocr1aShut;                               // Precalculated timer value based on shutPercentage and auto-calibration
-unsigned int ocr1aOpen;                               //       ,,        ,,    ,,    ,,          ,,                  ,,
+unsigned long trainTicks;                             // Number of ticks of 1 pulse train of 16 waves (depends on auto-calibration)
+unsigned long trainTicksQ8;                           // Integrator of the clock discipline: trainTicks with 8 fractional bits (all 32 bits at prescaler 1)
+byte ditherQ8;                                        // Fraction of a tick carried over to the next pulse train
+long secondMicrosQ8;                                  // Moving average of the GPS pulse intervals in micros(), 8 fractional bits
+unsigned long waveTicks;                              // Shortest number of ticks of 1 wave in the pulse train
+unsigned int ocr1aSchedule[N_HALF_WAVE];              // Precalculated timer values per half wave based on SHUTTER_CHANNELS and auto-calibration
+#ifdef HIGH_RESOLUTION
+byte segmentSchedule[N_HALF_WAVE];                    // Precalculated segmentsLeft per half wave, following the timer period of ocr1aSchedule
+#endif
+byte portSchedule[N_HALF_WAVE];                       // Precalculated pin values per half wave depending on the lock state
+
+// Global variables related to the warm start
+struct CalibrationRecord {
+  unsigned long sequence;                             // Incremented for each record saved, the highest valid value is the latest
+  unsigned long freq;                                 // MCU frequency measured with micros() since the previous record
+  unsigned long age;                                  // Seconds of clock discipline behind freq
+  unsigned int variance;                              // Mean square of the discipline residuals, in 1/256 ticks^2
+  byte checksum;                                      // See recordChecksum()
+};
+CalibrationRecord calibrationRecord;                  // Last record loaded from or saved to the EEPROM
+byte calibrationSlot = EEPROM_SLOTS - 1;              // EEPROM slot of calibrationRecord
+byte eepromBytesLeft = 0;                             // Bytes of calibrationRecord that eepromTask() has yet to write
+bool warmStart = false;                               // Whether calibrationRecord is valid for locking before N_STABLE
+unsigned long lockSeconds;                            // Seconds of clock discipline since entering the STABLE state
+long varianceQ8;                                      // Moving mean square of the discipline residuals, in 1/256 ticks^2
+unsigned long saveStartMicros;                        // lastGpsMicros at the previous record or at entering the STABLE state
+unsigned long saveStartSecond;                        // lockSeconds at the previous record or at entering the STABLE state, minus holdover seconds
 
 // Global variables related to the lock state
 unsigned long iGpsPulse = -1;                         // Number of successive GPS pulse intervals counted for stabilization and calibration
 unsigned long prevGpsMicros;                          // For checking timely arrival of current iGpsPulse
+unsigned long nextGpsMicros;                          // Expected arrival of the next GPS pulse in the STABLE state
 unsigned long gpsStartMicros;                         // Start time of a sequence of successive GPS pulses
+bool holdover = false;                                // HOLDOVER state, only while iGpsPulse >= N_STABLE
+unsigned long holdoverMaxMicros;                      // Duration of the holdover at which the predicted phase error exceeds HOLDOVER_LIMIT
+byte nRejected = 0;                                   // Number of successive rejected GPS pulses
+unsigned long rejectedMicros;                         // Arrival of the last rejected GPS pulse
+byte holdoverHalfWave;                                // iHalfWave at the previous check during holdover, for detecting a new pulse train
 
-// Global character buffer for sprintf() + Serial.println()
+// Global character buffer for sprintf() + Serial.println() in setup() and the debug logging
 const int S = 90;
 char s[S];
 
@@ -108,10 +271,53 @@ char s[S];
 const int NLOG = 100;                                 // About 3 seconds of hispeed logging
 volatile int iLog = -960;                             // This logging starts after 30 seonds of operation
 volatile unsigned long logIsr[NLOG];                  // Stores iIsr values
-volatile unsigned long logHalf[NLOG];                 // Stores iHalfWave values
+volatile byte logHalf[NLOG];                          // Stores iHalfWave values
 volatile unsigned long logMicros[NLOG];               // Stores micros()
 #endif
 
+#ifdef TRAIN_CAPTURE
+void captureTrain(unsigned int captured)
+{
+  // Called in an ISR with the TIMER1 value at the GPS pulse. If a compare match happened between the
+  // capture and the ISR, the TIMER1_COMPA interrupt is still pending (it has a lower priority) and
+  // a small captured value belongs to the next half wave.
+  byte halfWave = iHalfWave;
+  #ifdef HIGH_RESOLUTION
+  // The pending compare match may also end a timer period within the half wave
+  byte segments = segmentsLeft;
+  if ((TIFR1 & (1<<OCF1A)) && captured < OCR1A / 2) {
+    if (segments > 0) {
+      segments--;
+    } else {
+      halfWave = Shutter::next(halfWave);
+      segments = segmentSchedule[halfWave];
+    }
+  }
+  captureSegments = segments;
+  #else
+  if ((TIFR1 & (1<<OCF1A)) && captured < OCR1A / 2) {
+    halfWave = Shutter::next(halfWave);
+  }
+  #endif
+  captureTicks = captured;
+  captureHalfWave = halfWave;
+}
+#endif
+
+#ifdef PROFILER
+void profileCapture(unsigned int captured)
+{
+  // Ticks from the GPS pulse, captured in ICR1, up to now. If TIMER1 restarted in between, OCR1A still holds
+  // the previous timer period as long as the TIMER1_COMPA interrupt is pending, else the sample is skipped.
+  unsigned int ticks = TCNT1;
+  if (ticks >= captured) {
+    profileSample(PROFILE_GPS_LATENCY, ticks - captured);
+  } else if (TIFR1 & (1<<OCF1A)) {
+    profileSample(PROFILE_GPS_LATENCY, ticks + OCR1A + 1 - captured);
+  }
+}
+#endif
+
 /*
  * In the run_shutter_control() loop lastGpsMicros is used:
  *  - to derive the GPS lock state
@@ -121,47 +327,109 @@ volatile unsigned long logMicros[NLOG];               // Stores micros()
 void gpsIn()
 {
   cli();                                  // disable interrupts for making the value changes below in an atomic way
+  #ifdef HIGH_RESOLUTION
+  captureTrain(TCNT1);                    // phase of the pulse train with the resolution of TIMER1 instead of micros()
+  #endif
   lastGpsMicros = micros();               // the micros() value can be reliably read on entry of an ISR
   gpsHit = true;
+  trainIsr = iIsr;
   iIsr = 0;
+  #ifdef PROFILER
+  if (TIFR1 & (1<<ICF1)) {                // only with the GPS pulse on the input capture pin as well
+    TIFR1 = (1<<ICF1);
+    profileCapture(ICR1);
+  }
+  #endif
   sei();
 }
 
+#ifdef OUTPUT_COMPARE
+void armEdge(unsigned int ocr)
+{
+  // Set up the pin values for the compare match at the end of the current timer period: the next half wave
+  // after the last period of a half wave, else the pin values of the current half wave again (no edge).
+  // OCR1B gets the value of OCR1A, so that both pins change on the same timer clock.
+  byte i = iHalfWave;
+  #ifdef HIGH_RESOLUTION
+  if (segmentsLeft == 0) {
+    i = Shutter::next(i);
+  }
+  #else
+  i = Shutter::next(i);
+  #endif
+  OCR1B = ocr;
+  TCCR1A = CLEAR_MASK | portSchedule[i];
+}
+#endif
+
+#ifdef PPS_CAPTURE
+ISR(TIMER1_CAPT_vect)
+{
+  // The hardware copied TCNT1 into ICR1 at the GPS pulse
+  unsigned int captured = ICR1;
+  captureTrain(captured);
+  lastGpsMicros = micros();               // still used for calibration and for checking the lock state
+  gpsHit = true;
+  trainIsr = iIsr;
+  iIsr = 0;
+  #ifdef PROFILER
+  profileCapture(captured);
+  #endif
+}
+#endif
+
 ISR(TIMER1_COMPA_vect)
 {
-  // Use the PORTD register to have pins PIN_NEG and PIN_POS switch simultaneously
-  // Some added timing jitter between the start of the ISR and the new setting of PORTD
-  // cannot be avoided, because the conditional branches below follow a different sequence
-  // of instructions. However, this is at the microsecond level.
-  // ihalfWave == 0 or 32: blanking period
-  // iHalfWave == 1, 3, 5, ..., 31 odd, negative pulses on PIN3
-  // iHalfWave == 2, 4, 6, ..., 30 even, positive pulses on PIN4
+  // Use the PORTD register to have the pins of all channels switch simultaneously
+  // The pin values and timer compare values of all half waves are precalculated in portSchedule
+  // and ocr1aSchedule, so the instructions up to the new setting of PORTD do not contain any
+  // branches and take the same number of cycles for every half wave.
   //
-  // The LCD-shutter needs the slow decay mode of the H-bridge to become transparent. In the slow decay mode the
-  // terminals of the LCD-shutter are shortcut. The slow decay mode requires a logical high signal on both input
-  // terminals of the TB6612 module. This is different compared to the script version for controlling an
-  // opamp-based driver.
-
-  iIsr++;                     // At the end of a pulse train, iIsr and iHalfwave get a value 32 here;
-  iHalfWave++;                // Directly after a GPS pulse they are set to 0 by run_shutter_control()
-
-  byte pinVals;
-  if ((iHalfWave % 2 == 1) || (iGpsPulse >= N_STABLE && iHalfWave % N_HALF_WAVE == 0)) {
-    pinVals = (PORTD & ZERO_MASK) | HIGH_MASK;
-  } else if (iHalfWave % 4 == 2) {
-    pinVals = (PORTD & ZERO_MASK) | NEG_MASK;
-  } else {
-    pinVals = (PORTD & ZERO_MASK) | POS_MASK;
-  }
-  PORTD = pinVals;
+  // Cycle count from the TIMER1 compare match up to the PORTD write (ATmega328P at 16 MHz), estimated
+  // from the AVR instruction timings for the code that avr-gcc generates for the statements below:
+  //   interrupt response 4 + vector jmp 3 + prologue 17 (SREG and 6 registers) = 24 cycles
+  //   load and increment iHalfWave, mask, index two tables, read-modify-write PORTD = 14 cycles
+  //   total 38 cycles = 2.4 microseconds, the same for every half wave
+  // Worst case latency adds up to 4 cycles for finishing the interrupted instruction plus the duration
+  // of any other ISR or cli() section that is active at the compare match, e.g. the TIMER0 overflow
+  // ISR of the Arduino core (about 5 microseconds) or gpsIn().
+  // With HIGH_RESOLUTION, the test of segmentsLeft adds a few cycles, again the same for every half wave.
+  // The compare matches within a half wave only load the period of SEGMENT_TICKS, and as they are at least
+  // SEGMENT_TICKS away from the next half wave, a delay of their ISR does not move any pin change.
+  // With OUTPUT_COMPARE, the compare match itself has changed the pins and the latency above only has to stay
+  // below the duration of the new timer period.
 
-  // Alternate the "shut" and "open" timer compare values to realize the set shutPercentage
-  // Not combined with setting pinVals to avoid unnecessary execution time delays
-  if (iHalfWave % 2 == 1) {
-    OCR1A = ocr1aOpen;        // Corresponds to HIGH_MASK -> shutter terminals shortcut
-  } else {
-    OCR1A = ocr1aShut;        // Corresponds to NEG_MASK and POS_MARK -> voltage on shutter
+  #ifdef HIGH_RESOLUTION
+  if (segmentsLeft > 0) {
+    segmentsLeft--;
+    OCR1A = SEGMENT_TICKS - 1;
+    #ifdef OUTPUT_COMPARE
+    armEdge(SEGMENT_TICKS - 1);
+    #endif
+    return;
   }
+  #endif
+  byte i = Shutter::next(iHalfWave);                  // Directly after a GPS pulse iHalfWave is set to 0 by run_shutter_control()
+  #ifndef OUTPUT_COMPARE
+  PORTD = (PORTD & ZERO_MASK) | portSchedule[i];
+  #endif
+  #ifdef PROFILER
+  unsigned int edgeTicks = TCNT1;                     // TIMER1 restarted from 0 at the compare match
+  #endif
+  OCR1A = ocr1aSchedule[i];
+  #ifdef HIGH_RESOLUTION
+  segmentsLeft = segmentSchedule[i];
+  #endif
+  iHalfWave = i;
+  #ifdef OUTPUT_COMPARE
+  armEdge(ocr1aSchedule[i]);
+  #endif
+  iIsr++;                                             // At the end of a pulse train, iIsr gets the value N_HALF_WAVE here
+  #ifdef PROFILER
+  unsigned int endTicks = TCNT1;
+  profileSample(PROFILE_ISR_LATENCY, edgeTicks);
+  profileSample(PROFILE_ISR_DURATION, endTicks - edgeTicks);
+  #endif
 
   // Optional highspeed logging for debugging
   #ifdef DEBUG_LOG
@@ -174,51 +442,361 @@ ISR(TIMER1_COMPA_vect)
   #endif
 }
 
-void calibrate(unsigned int nPulse, unsigned long calibrationMicros)
+void buildPortSchedule(bool secondMarker)
+{
+  // iHalfWave == 0: blanking period, shutter terminals shortcut when showing second markers, else a positive pulse
+  // The pin values of the other half waves and the shortcut of the driver follow from Shutter (see shutter_waveform.h)
+  // The TIMER1 ISR reads single bytes of the table, so it is updated with interrupts enabled.
+  Shutter::copyPins(portSchedule, secondMarker);
+  #ifdef OUTPUT_COMPARE
+  cli();
+  armEdge(OCR1A);                                     // the edge at the end of the current timer period may be armed already
+  sei();
+  #endif
+}
+
+void scheduleHalfWave(byte i, unsigned long ticks)
+{
+  // In CTC mode a timer period lasts OCR1A + 1 ticks
+  #ifdef HIGH_RESOLUTION
+  // The first timer period takes SEGMENT_TICKS up to 2 * SEGMENT_TICKS - 1 ticks, so that every period is
+  // long enough for the ISR to load the next one
+  byte segments = (ticks >> SEGMENT_SHIFT) - 1;
+  ocr1aSchedule[i] = ticks - ((unsigned long)segments << SEGMENT_SHIFT) - 1;
+  segmentSchedule[i] = segments;
+  #else
+  ocr1aSchedule[i] = ticks - 1;
+  #endif
+}
+
+unsigned long halfWaveTicks(byte i)
+{
+  #ifdef HIGH_RESOLUTION
+  return ocr1aSchedule[i] + 1 + ((unsigned long)segmentSchedule[i] << SEGMENT_SHIFT);
+  #else
+  return ocr1aSchedule[i] + 1;
+  #endif
+}
+
+unsigned long halfWavePosition(byte i, byte segments, unsigned int ticks)
+{
+  // Ticks since the start of half wave i, given the TIMER1 value and, with HIGH_RESOLUTION, segmentsLeft
+  #ifdef HIGH_RESOLUTION
+  if (segments < segmentSchedule[i]) {
+    return ocr1aSchedule[i] + 1 + ((unsigned long)(segmentSchedule[i] - 1 - segments) << SEGMENT_SHIFT) + ticks;
+  }
+  #endif
+  return ticks;
+}
+
+void buildWaveSchedule()
+{
+  // Phase lock mechanisms 3 (see explanation at top of file)
+  // Round the start of each wave to the nearest tick of its ideal moment in the pulse train, so that the
+  // rounding residuals do not accumulate; the wave durations differ by at most one tick.
+  // Within a wave the edges of the channels are rounded down, e.g. the end of the shut part with one channel.
+  // The TIMER1 ISR reads the 16-bit table values, so update them with interrupts disabled.
+  unsigned long waveStart = 0;
+  byte i = 0;
+  for (int iWave = 0; iWave < N_WAVE; iWave++) {
+    unsigned long nextStart = (trainTicks * (iWave + 1) + N_WAVE / 2) / N_WAVE;
+    unsigned long ticks = nextStart - waveStart;
+    unsigned long partStart = 0;
+    for (byte k = 1; k <= EDGES_PER_WAVE; k++) {
+      unsigned long partEnd = k < EDGES_PER_WAVE ? ticks * Shutter::partPercentage(k) / 100 : ticks;
+      cli();
+      scheduleHalfWave(i++, partEnd - partStart);
+      sei();
+      partStart = partEnd;
+    }
+    waveStart = nextStart;
+  }
+}
+
+void setCalibratedFreq(unsigned long freq)
 {
   // Phase lock mechanism 2 for entire pulse train (see explanation at top of the file)
-  // Set OCR1A to the ideal value, calculated from the calibrated MCU clock
-  // Apply *** down *** rounding for the OCR1A calculation so that the block frequency is slightly
-  // too high rather than slightly too low and the syncing occurs during the blanking period
-  calibratedFreq = calibrationMicros / nPulse * MCU_MHZ;
-  waveTicks = calibratedFreq / PRESCALER / N_WAVE - TIMER_SAFETY;
-  ocr1aShut = (long)waveTicks * shutPercentage / 100;
-  ocr1aOpen = waveTicks - ocr1aShut;
-  snprintf(s, S, "Micros: %lu", calibrationMicros);
-  Serial.println(s);
-  snprintf(s, S, "MCU: %lu", calibratedFreq);
-  Serial.println(s);
-  snprintf(s, S, "Wave: %u %u ticks", ocr1aShut, ocr1aOpen);
-  Serial.println(s);
+  // Calculate the duration of the pulse train from the calibrated MCU clock
+  // Subtract TIMER_SAFETY so that the pulse train is slightly shorter than 1 second rather than
+  // slightly longer and the syncing occurs during the blanking period
+  calibratedFreq = freq;
+  trainTicks = calibratedFreq / PRESCALER - TIMER_SAFETY;
+  waveTicks = trainTicks / N_WAVE;
+  trainTicksQ8 = calibratedFreq * (256 / PRESCALER) - ((unsigned long)TIMER_SAFETY << 8);  // initial value for discipline()
+  ditherQ8 = 0;
+  buildWaveSchedule();
+}
 
-// Phase lock mechanisms 3 (see explanation at top of file)
-// Will not do; change to Nucleo-32 STM32G431 with crystal clock and 32-bit hardware timers
+void calibrate(unsigned int nPulse, unsigned long calibrationMicros)
+{
+  setCalibratedFreq(calibrationMicros / nPulse * MCU_MHZ);
+  logTelemetry(TM_CALIBRATION, calibrationMicros, calibratedFreq, trainTicks);
 }
 
-void setup_shutter_control(int dutyCycle)
+byte recordChecksum(const CalibrationRecord &record)
 {
-  shutPercentage = dutyCycle;
+  // Rotate and xor over all bytes before the checksum, seeded such that an erased record is invalid
+  const byte *data = (const byte *)&record;
+  byte checksum = 0xA5;
+  for (unsigned int i = 0; i < offsetof(CalibrationRecord, checksum); i++) {
+    checksum = ((checksum << 1) | (checksum >> 7)) ^ data[i];
+  }
+  return checksum;
+}
+
+bool loadCalibration()
+{
+  // The EEPROM holds a ring of EEPROM_SLOTS records, of which the valid one with the highest sequence
+  // number is the latest. A record that was partly written during a power loss fails the checksum.
+  bool found = false;
+  for (byte i = 0; i < EEPROM_SLOTS; i++) {
+    CalibrationRecord record;
+    EEPROM.get(i * sizeof(CalibrationRecord), record);
+    if (record.checksum != recordChecksum(record) || record.freq < MIN_FREQ || record.freq > MAX_FREQ) {
+      continue;
+    }
+    if (!found || record.sequence > calibrationRecord.sequence) {
+      calibrationRecord = record;
+      calibrationSlot = i;
+      found = true;
+    }
+  }
+  return found;
+}
+
+void saveCalibration()
+{
+  // The frequency is measured like in calibrate(), over the seconds since the previous record (< 4200
+  // for the micros() overflow), including those of a holdover, which the end of the holdover subtracts
+  // from saveStartSecond. Unlike the frequency derived from the clock discipline, it does not
+  // include the constant offset of the syncing, so that it is comparable with GPS pulse intervals.
+  // Wear levelling: each record goes to the slot after the latest one, so the EEPROM cells are written
+  // EEPROM_SLOTS times less often. A byte takes about 3.4 ms to write, so eepromTask() writes the record
+  // one byte per run in between the other tasks instead of blocking loop() here for 50 ms.
+  if (eepromBytesLeft > 0) {
+    return;                                                         // the previous record is still being written
+  }
+  calibrationRecord.sequence++;
+  calibrationRecord.freq = (lastGpsMicros - saveStartMicros) / (lockSeconds - saveStartSecond) * MCU_MHZ;
+  calibrationRecord.age = lockSeconds;
+  calibrationRecord.variance = min(varianceQ8, 0xFFFFL);
+  calibrationRecord.checksum = recordChecksum(calibrationRecord);
+  calibrationSlot = (calibrationSlot + 1) % EEPROM_SLOTS;
+  eepromBytesLeft = sizeof(CalibrationRecord);
+  saveStartMicros = lastGpsMicros;
+  saveStartSecond = lockSeconds;
+  warmStart = true;
+  logTelemetry(TM_SAVED, calibrationRecord.freq, calibrationRecord.age, 0, calibrationRecord.variance);
+}
 
+bool eepromPending()
+{
+  return eepromBytesLeft > 0;
+}
+
+void eepromTask()
+{
+  // A record that is cut short by a reset fails its checksum, so loadCalibration() takes the previous one
+  byte i = sizeof(CalibrationRecord) - eepromBytesLeft;
+  EEPROM.update(calibrationSlot * sizeof(CalibrationRecord) + i, ((const byte *)&calibrationRecord)[i]);
+  eepromBytesLeft--;
+}
+
+void setTrainTicksQ8(unsigned long controlQ8)
+{
+  // The fraction of a tick is dithered over successive pulse trains
+  controlQ8 += ditherQ8;
+  trainTicks = controlQ8 >> 8;
+  ditherQ8 = controlQ8 & 0xFF;
+  waveTicks = trainTicks / N_WAVE;
+  buildWaveSchedule();
+}
+
+long trainPhase(byte halfWave, unsigned long ticks)
+{
+  // Position in the pulse train given as half wave and ticks since its start, relative to the start of the
+  // pulse train for the first half of the train and negative relative to its end for the second half
+  long phase = ticks;
+  if (halfWave < N_HALF_WAVE / 2) {
+    for (byte i = 0; i < halfWave; i++) {
+      phase += halfWaveTicks(i);
+    }
+  } else {
+    for (byte i = halfWave; i < N_HALF_WAVE; i++) {
+      phase -= halfWaveTicks(i);
+    }
+  }
+  return phase;
+}
+
+void discipline(long phaseTicks)
+{
+  // Phase lock mechanism 2, continuous part (see explanation at top of the file)
+  // phaseTicks is the number of ticks that the previous pulse train ended before the GPS pulse. Its
+  // deviation from TIMER_SAFETY is the error of trainTicks during the previous second, including a
+  // constant offset of the syncing. A PI filter in fixed point arithmetic (8 fractional bits) turns
+  // it into the duration of the next pulse train, with sub-tick resolution on average.
+  // As the integrator absorbs the offset of the syncing, calibratedFreq follows from a moving average of
+  // the GPS pulse intervals instead, which is also the MCU frequency used in holdover.
+  // With UBX_TIMEPULSE, the quantization error of the GPS pulse, which is far below a tick, is subtracted
+  // in the fractional bits of the phase and of the GPS pulse interval.
+  long residual = constrain(phaseTicks - TIMER_SAFETY, -PI_CLAMP, PI_CLAMP);
+  long errorQ8 = 0;
+  long intervalErrorQ8 = 0;
+  #ifdef GPS_TIME
+  errorQ8 = gpsPulseErrorQ8();
+  intervalErrorQ8 = gpsIntervalErrorQ8();
+  #endif
+  long residualQ8 = (residual << 8) - errorQ8 * MCU_MHZ / PRESCALER;
+  if (lockSeconds == 0) {
+    // Right after the preliminary calibration, the residual is mostly the constant offset of the syncing:
+    // the integrator takes it at once instead of settling over tens of seconds. Half a tick less, for the
+    // rounding of the phase to whole ticks: all of it can leave a residual of 0 with the train a tick too
+    // long, which stops the dithering of the fraction of a tick.
+    trainTicksQ8 += residualQ8 - 128;
+    setTrainTicksQ8(trainTicksQ8);
+  } else {
+    trainTicksQ8 += residualQ8 >> PI_KI_SHIFT;
+    setTrainTicksQ8(trainTicksQ8 + (residualQ8 >> PI_KP_SHIFT));
+  }
+  secondMicrosQ8 += ((long)((lastGpsMicros - prevGpsMicros) << 8) - intervalErrorQ8 - secondMicrosQ8) >> 4;
+  calibratedFreq = secondMicrosQ8 / (256 / MCU_MHZ);
+  logTelemetry(TM_RESIDUAL, residual, calibratedFreq, errorQ8);
+
+  // Keep the disciplined MCU frequency for the next boot
+  long square = min(residual * residual, 0x7FFFFFL);               // no overflow of PI_CLAMP squared at prescaler 1
+  varianceQ8 += ((square << 8) - varianceQ8) >> 4;
+  lockSeconds++;
+  if (lockSeconds == N_SAVE_FIRST || lockSeconds % N_SAVE == 0) {
+    saveCalibration();
+  }
+}
+
+unsigned long holdoverBound(unsigned long seconds)
+{
+  // Predicted phase error in microseconds after a holdover of the given duration
+  return HOLDOVER_PPM * seconds + HOLDOVER_DRIFT_PPB * seconds * seconds / 2000;
+}
+
+void loseLock()
+{
+  iGpsPulse = N_INIT;
+  holdover = false;
+  nRejected = 0;
+  buildPortSchedule(false);                                         // stop second markers
+  logTelemetry(TM_LOCK_LOST);
+}
+
+void checkHoldover()
+{
+  // Called while waiting for a GPS pulse in the STABLE state; prevGpsMicros is the last accepted pulse
+  // Without the syncing each second, the pulse trains last one second of calibratedFreq rather than the
+  // duration from the clock discipline. The dithering of the fractional tick continues for each new
+  // pulse train, detected by iHalfWave wrapping around.
+  unsigned long holdoverMicros = micros() - prevGpsMicros;
+  byte halfWave = iHalfWave;
+  if (!holdover && holdoverMicros > (unsigned long)(secondMicrosQ8 >> 8) + PULSE_WINDOW_MICROS) {
+    holdover = true;
+    holdoverHalfWave = N_HALF_WAVE;
+    logTelemetry(TM_HOLDOVER_START);
+  }
+  if (holdover && halfWave < holdoverHalfWave) {
+    setTrainTicksQ8((unsigned long)secondMicrosQ8 * MCU_MHZ / PRESCALER);
+  }
+  holdoverHalfWave = halfWave;
+  if (holdoverMicros > holdoverMaxMicros) {
+    loseLock();
+  }
+}
+
+#ifdef SD_LOG
+void sdLogTask()
+{
+  // Write a full sector in between two edges of the pulse train; the scheduler only runs this task when
+  // even a slow write ends before the next GPS pulse
+  if (ticksToCompare() > SD_WRITE_TICKS) {
+    writeSdLog();
+  }
+}
+#endif
+
+void setup_shutter_control()
+{
   // PIN I/O configs
+  #ifdef PPS_CAPTURE
+  pinMode(PIN_ICP, INPUT);
+  #else
   attachInterrupt(digitalPinToInterrupt(PIN_GPS), gpsIn, RISING);
+  #endif
+  #ifdef OUTPUT_COMPARE
   pinMode(PIN_NEG, OUTPUT);
   pinMode(PIN_POS, OUTPUT);
+  #else
+  for (byte c = 0; c < N_CHANNEL; c++) {
+    pinMode(SHUTTER_CHANNELS[c].pinNeg, OUTPUT);
+    pinMode(SHUTTER_CHANNELS[c].pinPos, OUTPUT);
+  }
+  #endif
 
   // TIMER1 configs for creating a continuous sequence of ISR interrupts
   // TIMER1 is available if the Arduino servo library is not required
   // TIMER0 is occupied by Arduino core for the millis()/micros() functions
+  buildPortSchedule(false);                                         // no second markers before the STABLE state
+  setCalibratedFreq(calibratedFreq);                                // boot value, for valid compare values from the first interrupt on
+  iHalfWave = N_HALF_WAVE - 1;                                      // the first compare match starts the pulse train
   TCCR1A = 0x00;                                                    // reset TIMER1 control register
+  #ifdef OUTPUT_COMPARE
+  armEdge(OCR1A);                                                   // the first compare match sets the pins of half wave 0
+  #endif
+  #ifdef HIGH_RESOLUTION
+  TCCR1B = (1<<CS10);                                               // no prescaling (OCR1A ticks of 62.5 nanoseconds)
+  #else
   TCCR1B = (1<<CS10) | (1<<CS11);                                   // set the prescalar at 64 (OCR1A ticks of 4 microsecond)
+  #endif
   TCCR1B |= (1<<WGM12);                                             // set CTC mode (Clear Timer on Compare)
   TIMSK1 |= (1<<OCIE1A);                                            // enable TIMER1 interrupts
+  #ifdef PPS_CAPTURE
+  TCCR1B |= (1<<ICNC1) | (1<<ICES1);                                // noise canceler, capture on the rising edge of the GPS pulse
+  TIFR1 = (1<<ICF1);                                                // clear a stale capture
+  TIMSK1 |= (1<<ICIE1);                                             // enable TIMER1 capture interrupts
+  #elif defined(PROFILER)
+  TCCR1B |= (1<<ICES1);                                             // capture without interrupt, for the latency of gpsIn()
+  #endif
   TCNT1 = 0;                                                        // TIMER1 counter start value
 
-  snprintf(s, S, "Waveform-H-bridge version: %s", VERSION);
+  snprintf_P(s, S, PSTR("Waveform-H-bridge version: %s"), VERSION);
   Serial.println(s);
-  snprintf(s, S, "Electrical blocking percentage: %u%%", shutPercentage);
+  for (byte c = 0; c < N_CHANNEL; c++) {
+    int n = snprintf_P(s, S, PSTR("Electrical blocking percentage: %u%%"), SHUTTER_CHANNELS[c].shutPercentage);
+    if (SHUTTER_CHANNELS[c].offsetPercentage > 0) {
+      snprintf_P(s + n, S - n, PSTR(", phase offset: %u%%"), SHUTTER_CHANNELS[c].offsetPercentage);
+    }
+    Serial.println(s);
+  }
+  if (loadCalibration()) {
+    warmStart = true;
+    setCalibratedFreq(calibrationRecord.freq);                      // set initial TIMER1 compare values from the previous session
+    snprintf_P(s, S, PSTR("Stored MCU: %lu, age: %lu s, variance: %u"), calibrationRecord.freq, calibrationRecord.age,
+      calibrationRecord.variance);
+    Serial.println(s);
+  } else {
+    calibrate(1, 1000000L);                                         // set initial TIMER1 compare values assuming zero phase difference
+    flushTelemetry();
+  }
+  unsigned long holdoverSeconds = 0;
+  while (holdoverBound(holdoverSeconds + 1) <= HOLDOVER_LIMIT && holdoverSeconds < 4000) {  // < 4200 for micros() overflow
+    holdoverSeconds++;
+  }
+  holdoverMaxMicros = (holdoverSeconds + 1) * 1000000;
+  snprintf_P(s, S, PSTR("Max holdover: %lu s"), holdoverSeconds);
   Serial.println(s);
-  calibrate(1, 1000000L);                                           // set initial TIMER1 compare values assuming zero phase difference
-  Serial.println("Stabilizing...");
+  addTask(drainTelemetry, DRAIN_TASK_MICROS, telemetryPending);
+  addTask(eepromTask, EEPROM_TASK_MICROS, eepromPending);
+  #ifdef SD_LOG
+  setupSdLog();
+  addTask(sdLogTask, SD_TASK_MICROS, sdSectorReady);
+  #endif
+  Serial.println(F("Stabilizing..."));
 
   // Offline execution time measurements of copied code block: takes 48 microseconds = 12 ticks
   // unsigned long observedMicros = micros();
@@ -226,106 +804,272 @@ void setup_shutter_control(int dutyCycle)
   // unsigned long observedTicks = observedDiff / TICK_MICROS;
   // int numWave = observedTicks / waveTicks;
   // unsigned long newHalfWave = 2 * numWave;
-  // unsigned int newOCR1A;
+  // unsigned int newOCR1A = ocr1aSchedule[newHalfWave % N_HALF_WAVE];
   // unsigned int newTCNT1 = observedTicks - numWave * waveTicks;
-  // if ((newTCNT1) >= ocr1aShut) {
+  // if (newTCNT1 > newOCR1A) {
   //   newHalfWave += 1;
-  //   newTCNT1 -= ocr1aShut;
-  //   newOCR1A = ocr1aOpen;
-  // } else {
-  //   newOCR1A = ocr1aShut;
+  //   newTCNT1 -= newOCR1A + 1;
+  //   newOCR1A = ocr1aSchedule[newHalfWave % N_HALF_WAVE];
   // }
   // OCR1A = newOCR1A;
   // TCNT1 = newTCNT1 + compensationTicks;
   // unsigned long time2 = micros();
   // Serial.println(observedMicros);
   // Serial.println(time2);
-  compensationTicks = 12;
+  compensationTicks = COMPENSATION_MICROS * MCU_MHZ / PRESCALER;
+}
+
+long microsToDeadline()
+{
+  // Microseconds that other tasks in loop() may take without delaying the processing of the next GPS
+  // pulse, which can arrive PULSE_WINDOW ticks before its expected moment. During a holdover the expected
+  // moment moves on by one second once the window has passed.
+  if (gpsHit) {
+    return 0;
+  }
+  if ((long)iGpsPulse < N_STABLE) {
+    return NO_DEADLINE;
+  }
+  long earlyMicros = PULSE_WINDOW_MICROS;
+  long leftMicros = nextGpsMicros - micros();
+  if (leftMicros < -earlyMicros) {
+    nextGpsMicros += secondMicrosQ8 >> 8;
+    leftMicros += secondMicrosQ8 >> 8;
+  }
+  return leftMicros - earlyMicros - DEADLINE_MARGIN;
+}
+
+unsigned long ticksToCompare()
+{
+  // Ticks up to the TIMER1 compare match of the next edge of the pulse train, 0 if a match already happened
+  // and the ISR has yet to load OCR1A with the next timer period
+  cli();
+  unsigned int ocr = OCR1A;
+  unsigned int ticksLeft = ocr - TCNT1;
+  bool matched = TIFR1 & (1<<OCF1A);
+  #ifdef HIGH_RESOLUTION
+  byte segments = segmentsLeft;
+  #endif
+  sei();
+  if (matched || ticksLeft > ocr) {
+    return 0;
+  }
+  #ifdef HIGH_RESOLUTION
+  return ticksLeft + ((unsigned long)segments << SEGMENT_SHIFT);
+  #else
+  return ticksLeft;
+  #endif
+}
+
+void logPulse(byte state, long phaseTicks)
+{
+  #ifdef SD_LOG
+  SdRecord record = {iGpsPulse, lastGpsMicros, calibratedFreq, 0, (int16_t)constrain(phaseTicks, -32768L, 32767L), state,
+    (byte)min(trainIsr, 255UL)};
+  #ifdef GPS_TIME
+  record.utc = gpsPulseUtc();
+  if (gpsPulseFix()) {
+    record.state |= SD_FIX;
+  }
+  #endif
+  logSdRecord(record);
+  #endif
 }
 
 void run_shutter_control()
 {
   if (!gpsHit) {
+    if ((long)iGpsPulse >= N_STABLE) {
+      checkHoldover();
+    }
     return;
   }
   iGpsPulse++;                                                      // Overflow after 2^32 / 86400 / 365 = 136 years
+  // Restart the preliminary calibration from a GPS pulse interval that does not fit the MCU clock
+  unsigned long intervalMicros = lastGpsMicros - prevGpsMicros;
+  if (iGpsPulse > 0 && iGpsPulse < N_STABLE &&
+      (intervalMicros < MIN_FREQ / MCU_MHZ || intervalMicros > MAX_FREQ / MCU_MHZ)) {
+    logTelemetry(TM_INTERVAL, intervalMicros);
+    iGpsPulse = N_ZERO;
+  }
   if (iGpsPulse == 0) {
     gpsStartMicros = lastGpsMicros;
   }
+  // Warm start: skip the preliminary calibration if the GPS pulse intervals agree with the stored frequency
+  bool warmLock = false;
+  if (warmStart && iGpsPulse > 0 && iGpsPulse < N_STABLE) {
+    long warmDiff = lastGpsMicros - prevGpsMicros - calibrationRecord.freq / MCU_MHZ;
+    if (abs(warmDiff) > WARM_WINDOW) {
+      warmStart = false;                                            // continue with the preliminary calibration
+      logTelemetry(TM_WARM_REJECTED, warmDiff);
+    } else if (iGpsPulse == N_WARM) {
+      iGpsPulse = N_STABLE;
+      warmLock = true;
+    }
+  }
   if (iGpsPulse >= N_STABLE) {
+    // Preliminary calibration of the MCU clock against the GPS pulses. It comes before the syncing below, so
+    // that already the first pulse train of the STABLE state gets the calibrated half waves; else that train
+    // ends up to a wave of rounding early and the clock discipline needs tens of seconds to settle again.
+    if (iGpsPulse == N_STABLE) {
+      if (warmLock) {
+        setCalibratedFreq(calibrationRecord.freq);                  // restart the clock discipline
+        logTelemetry(TM_WARM_START);
+      } else {
+        calibrate(N_STABLE, lastGpsMicros - gpsStartMicros);
+      }
+    }
+
     // Beware of concurrency issues; do not touch TIMER1 close to an ISR, so introduce a short delay if necessary
     // OCR1A is calculated such that avoidance should not happen during stable conditions
     unsigned int delayTicks = OCR1A - TCNT1;
-    if (delayTicks < 50) {     // 50 an arbitrary number of ticks sufficient to execute the syncing further below
-      delayMicroseconds((delayTicks + 8) * TICK_MICROS);
-      if (iGpsPulse % 6 == 0) {
-        snprintf(s, S, "Avoidance triggered! OCR1A: %u, TCNT1: %u", OCR1A, TCNT1);
-        Serial.println(s);
-      }
+    if (delayTicks < AVOID_TICKS) {
+      delayMicroseconds((unsigned long)delayTicks * PRESCALER / MCU_MHZ + 32);
+      logTelemetry(TM_AVOIDANCE, OCR1A, TCNT1);
     }
 
     // Phase lock mechanisms 1 for the start of the pulse train each second (see explanation at top of file)
     // Phase of the pulse train: iHalfWave * OCR1A + TCNT1
     unsigned long oldIsr = iIsr;                                    // iIsr at time of phaseDiff measurement
-    unsigned long oldHalfWave = iHalfWave;                          // for printing phaseDiff below
+    byte oldHalfWave = iHalfWave;                                   // for printing phaseDiff below
     unsigned int oldTCNT1 = TCNT1;                                  // for printing phaseDiff below
+
+    // Ticks that the previous pulse train ended before the GPS pulse, for the phase window and the clock discipline
+    #ifdef TRAIN_CAPTURE
+    #ifdef HIGH_RESOLUTION
+    unsigned long capturePosition = halfWavePosition(captureHalfWave, captureSegments, captureTicks);
+    #else
+    unsigned long capturePosition = captureTicks;
+    #endif
+    long phaseTicks = trainPhase(captureHalfWave, capturePosition);
+    #else
+    unsigned long oldMicros = micros();
+    long phaseTicks = trainPhase(oldHalfWave, oldTCNT1) - (long)((oldMicros - lastGpsMicros) * MCU_MHZ / PRESCALER);
+    #endif
+
+    // Reject a GPS pulse out of phase with the pulse train (interference on the GPS pulses), without a sync
+    // Tested: the script recovers OK from a manually triggered unexpected GPS pulse
+    // (pin D2 connected momentarily to GND via a test lead with a 100 Ohm resistor)
+    if (iGpsPulse > N_STABLE && abs(phaseTicks) > PULSE_WINDOW) {
+      logTelemetry(TM_REJECTED, phaseTicks);
+      logPulse(SD_REJECTED, phaseTicks);
+      gpsHit = false;
+      // Only rejected pulses one second apart count as successive: the GPS pulse has moved
+      long rejectedDiff = lastGpsMicros - rejectedMicros - (secondMicrosQ8 >> 8);
+      nRejected = abs(rejectedDiff) > PULSE_WINDOW_MICROS ? 1 : nRejected + 1;
+      rejectedMicros = lastGpsMicros;
+      if (nRejected >= N_REJECT) {
+        loseLock();
+      }
+      return;
+    }
+    nRejected = 0;
+    #ifdef TRAIN_CAPTURE
+    // Ticks since the GPS pulse follow from the captured timer value and the half waves completed since then
+    cli();
+    unsigned int startTCNT1 = TCNT1;
+    byte startHalfWave = iHalfWave;
+    #ifdef HIGH_RESOLUTION
+    unsigned long startPosition = halfWavePosition(startHalfWave, segmentsLeft, startTCNT1);
+    #else
+    unsigned long startPosition = startTCNT1;
+    #endif
+    sei();
+    byte passedHalfWaves = Shutter::distance(captureHalfWave, startHalfWave);
+    unsigned long observedTicks = startPosition - capturePosition;  // small value in lock state, depending on other tasks in loop()
+    for (byte i = 0; i < passedHalfWaves; i++) {
+      observedTicks += halfWaveTicks((captureHalfWave + i) % N_HALF_WAVE);
+    }
+    #else
     // Start of code block for which execution time needs to be compensated
     unsigned long observedMicros = micros();                        // separate statement to allow for time measurement
     unsigned long observedDiff = observedMicros - lastGpsMicros;    // small value in lock state, depending on other tasks in loop()
-    unsigned long observedTicks = observedDiff / TICK_MICROS;
-    int numWave = observedTicks / waveTicks;
-    unsigned long newHalfWave = 2 * numWave;
-    unsigned int newOCR1A;
-    unsigned int newTCNT1 = observedTicks - numWave * waveTicks;
-    if ((newTCNT1) >= ocr1aShut) {
+    unsigned long observedTicks = observedDiff * MCU_MHZ / PRESCALER;
+    #endif
+    int numWave = observedTicks / waveTicks;                        // Rounds down, because waveTicks is the shortest wave
+    unsigned long newHalfWave = EDGES_PER_WAVE * numWave;
+    unsigned long newTicks = observedTicks - numWave * waveTicks;   // ticks since the start of newHalfWave
+    while (newTicks >= halfWaveTicks(newHalfWave % N_HALF_WAVE)) {  // at most once with one channel
+      newTicks -= halfWaveTicks(newHalfWave % N_HALF_WAVE);
       newHalfWave += 1;
-      newTCNT1 -= ocr1aShut;
-      newOCR1A = ocr1aOpen;
-    } else {
-      newOCR1A = ocr1aShut;
     }
+    unsigned int newOCR1A = ocr1aSchedule[newHalfWave % N_HALF_WAVE];
+    #ifdef HIGH_RESOLUTION
+    // Continue in the timer period of the half wave that contains newTicks
+    byte newSegments = segmentSchedule[newHalfWave % N_HALF_WAVE];
+    if (newTicks > newOCR1A) {
+      newTicks -= newOCR1A + 1;
+      newSegments -= (newTicks >> SEGMENT_SHIFT) + 1;
+      newTicks &= SEGMENT_TICKS - 1;
+      newOCR1A = SEGMENT_TICKS - 1;
+    }
+    #endif
+    unsigned int newTCNT1 = newTicks;
     OCR1A = newOCR1A;
+    #ifdef TRAIN_CAPTURE
+    TCNT1 = newTCNT1 + (TCNT1 - startTCNT1);                        // add the ticks passed since observedTicks was taken
+    #else
     TCNT1 = newTCNT1 + compensationTicks;
     // End of code block for which execution time needs to be compensated
-    iHalfWave = newHalfWave;
+    #endif
+    iHalfWave = newHalfWave % N_HALF_WAVE;
+    #ifdef HIGH_RESOLUTION
+    segmentsLeft = newSegments;
+    #endif
+    #ifdef OUTPUT_COMPARE
+    armEdge(newOCR1A);                                              // the pins keep their values up to the edge of the new half wave
+    #endif
+    #ifdef GPS_TIME
+    tagGpsPulse(lastGpsMicros);                                     // UTC second of the GPS pulse for the logs
+    #endif
+    #ifdef PROFILER
+    profileSample(PROFILE_SYNC, observedTicks);
+    #endif
 
     // Log experienced phase difference to serial monitor
-    if (iGpsPulse % 6 == 0) {
-      oldHalfWave = oldHalfWave % N_HALF_WAVE;
-      snprintf(s, S, "LCD phase: %lu %lu %lu %u", oldIsr, observedTicks, oldHalfWave, oldTCNT1);
-      Serial.println(s);
-    }
+    logTelemetry(TM_PHASE, oldIsr, observedTicks, oldHalfWave, oldTCNT1);
 
-    // Preliminary calibration of the MCU clock against the GPS pulses
-    unsigned long calibrationMicros = lastGpsMicros - gpsStartMicros;
     if (iGpsPulse == N_STABLE) {
-      calibrate(N_STABLE, calibrationMicros);
-    }
-
-    // Periodoc calibration of the MCU clock against the GPS pulses
-    // Successive calibration windows are used, longer rolling windows seems unnecessary
-    if ( (iGpsPulse % N_CALIBRATE) == 0) {
-      calibrate(N_CALIBRATE, calibrationMicros);
-      gpsStartMicros = lastGpsMicros;
+      lockSeconds = 0;
+      varianceQ8 = 0;
+      secondMicrosQ8 = calibratedFreq * (256 / MCU_MHZ);
+      saveStartMicros = lastGpsMicros;
+      saveStartSecond = 0;
+      buildPortSchedule(true);                                      // start second markers
     }
 
-    // Interrupt second markers if phase stability is too low (interference on GPS pulses)
-    // Tested: the script recovers OK from a manually triggered unexpected GPS pulse
-    // (pin D2 connected momentarily to GND via a test lead with a 100 Ohm resistor)
-    long phaseDiff = lastGpsMicros - prevGpsMicros - calibratedFreq / MCU_MHZ;
-    if (abs(phaseDiff) > 1000) {                                    // Arbitrary value
-      iGpsPulse = N_INIT;
-      Serial.println("Lock with GPS signal lost");
+    // Continuous calibration of the MCU clock against the GPS pulses
+    // After a holdover the phase difference covers several seconds, so only the syncing is done
+    if (holdover) {
+      holdover = false;
+      setTrainTicksQ8(trainTicksQ8);                                // back to the pulse train duration of the clock discipline
+      // Whole seconds of the holdover in MCU microseconds, which differ from true microseconds by the clock error
+      unsigned long secondMicros = secondMicrosQ8 >> 8;
+      unsigned long holdoverSeconds = (lastGpsMicros - prevGpsMicros + secondMicros / 2) / secondMicros;
+      saveStartSecond -= holdoverSeconds;                           // seconds without discipline(), for saveCalibration()
+      logTelemetry(TM_HOLDOVER_END, holdoverSeconds, phaseTicks, holdoverBound(holdoverSeconds));
+      logPulse(SD_HOLDOVER_END, phaseTicks);
+    } else {
+      if (iGpsPulse > N_STABLE) {
+        discipline(phaseTicks);
+      }
+      logPulse(SD_LOCKED, phaseTicks);
     }
+    nextGpsMicros = lastGpsMicros + (secondMicrosQ8 >> 8);
+  } else {
+    #ifdef GPS_TIME
+    tagGpsPulse(lastGpsMicros);
+    #endif
+    logPulse(SD_CALIBRATING, 0);
   }
 
   // Optional highspeed logging for debugging
   #ifdef DEBUG_LOG
   if (iLog >= NLOG - 1 && iLog < 2 * NLOG - 2) {
-    snprintf(s, S, "\nHispeed logging results preceding %lu\n", lastGpsMicros);
+    snprintf_P(s, S, PSTR("\nHispeed logging results preceding %lu\n"), lastGpsMicros);
     Serial.println(s);
     for (int i=0; i < NLOG; i++) {
-      snprintf(s, S, "iIsr: %lu iHalfWave: %lu  micros: %lu", logIsr[i], logHalf[i], logMicros[i]);
+      snprintf_P(s, S, PSTR("iIsr: %lu iHalfWave: %u  micros: %lu"), logIsr[i], logHalf[i], logMicros[i]);
       Serial.println(s);
     }
   }
@@ -1,4 +1,15 @@
 const char VERSION[] = "0.2.0";
 
-void setup_shutter_control(int dutyCycle);
+#define HIGH_RESOLUTION
+#undef HIGH_RESOLUTION                                // Outcomment to clock TIMER1 at 16 MHz (ticks of 62.5 nanoseconds instead of 4 microseconds)
+
+#ifdef HIGH_RESOLUTION
+const int PRESCALER = 1;                              // Prescaler value to be set for TIMER1, half waves take several timer periods
+#else
+const int PRESCALER = 64;                             // Prescaler value to be set for TIMER1
+#endif
+
+void setup_shutter_control();
 void run_shutter_control();
+long microsToDeadline();
+unsigned long ticksToCompare();
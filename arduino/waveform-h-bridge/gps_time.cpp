@@ -0,0 +1,446 @@
+/*
+Parser of the RMC and ZDA sentences of the GPS receiver (see gps_time.h).
+
+Unlike SoftwareSerial, which disables interrupts for the duration of each received byte, the hardware
+UART receives the bytes in the background; the Arduino core buffers them (64 bytes) in its receive
+interrupt of about 3 microseconds per byte. pollGpsTime() takes at most GPS_POLL_BYTES bytes from that
+buffer per call and handles each byte in constant time, without string functions, divisions or floating
+point arithmetic. A sentence that completes in a call ends that call, because it adds the conversion of
+the date and time to seconds since 1970.
+
+At 9600 baud about one byte per millisecond arrives, while loop() runs far more often, so the buffer
+only fills during long blocking actions, e.g. a slow SD card write. A sentence that loses bytes fails
+the checksum and is ignored.
+
+The receiver must use the baud rate of Serial.begin() in waveform-h-bridge.ino. Other sentences are
+skipped, but disabling them on the receiver saves receive interrupts (see doc/u-blox8-configuration.md).
+
+With UBX_TIMEPULSE, the same bytes also pass a second state machine for UBX messages, of which only
+TIM-TP is used. The receiver sends TIM-TP about half a second before the pulse that it describes, so the
+last valid TIM-TP before a GPS pulse gives the quantization error of that pulse.
+*/
+#include <arduino.h>
+#include "gps_time.h"
+#include "scheduler.h"
+#include "telemetry.h"
+
+#ifdef GPS_TIME
+
+const byte GPS_POLL_BYTES = 8;                        // Max bytes parsed per call of pollGpsTime(), about 80 microseconds
+const unsigned long GPS_TASK_MICROS = 300;            // Worst-case pollGpsTime(), including the end of a sentence
+const unsigned long GPS_SENTENCE_MICROS = 900000;     // Sentences completing later after the GPS pulse are not associated with it
+const unsigned long GPS_COUNT_MICROS = 60500000;      // Max GPS pulse interval over which the UTC second is counted on (0.5% MCU clock error)
+const byte NMEA_DIGITS = 6;                           // Digits stored per field, e.g. hhmmss
+const unsigned int DAYS_BEFORE_MONTH[12] = {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334};
+
+#ifdef UBX_TIMEPULSE
+const byte UBX_SYNC1 = 0xB5;
+const byte UBX_SYNC2 = 0x62;
+const byte UBX_CLASS_CFG = 0x06;
+const byte UBX_CLASS_TIM = 0x0D;
+const byte UBX_CFG_MSG = 0x01;
+const byte UBX_CFG_TP5 = 0x31;
+const byte UBX_TIM_TP = 0x01;
+const byte TIM_TP_LENGTH = 16;                        // Payload bytes of TIM-TP
+const byte TIM_TP_QERR_INVALID = 0x10;                // Bit in the flags of TIM-TP
+
+// CFG-TP5 payload for the TIMEPULSE output, little endian (see doc/u-blox8-configuration.md)
+const byte CFG_TP5_PAYLOAD[32] = {
+  0, 0, 0, 0,                                         // tpIdx TIMEPULSE, version, reserved
+  50, 0, 0, 0,                                        // antCableDelay 50 ns (default), rfGroupDelay
+  1, 0, 0, 0,                                         // freqPeriod 1 Hz
+  1, 0, 0, 0,                                         // freqPeriodLock 1 Hz
+  0x50, 0xC3, 0, 0,                                   // pulseLenRatio 50000 us
+  0x50, 0xC3, 0, 0,                                   // pulseLenRatioLock 50000 us
+  0, 0, 0, 0,                                         // userConfigDelay
+  0x7B, 0, 0, 0,                                      // flags: active, lockGnssFreq, isFreq, isLength, alignToTow, rising edge, UTC grid
+};
+
+// CFG-MSG payloads (class, id, rate on the current port): TIM-TP on, NMEA sentences not parsed off
+const byte CFG_MSG_PAYLOADS[][3] = {
+  {UBX_CLASS_TIM, UBX_TIM_TP, 1},
+  {0xF0, 0x00, 0},                                    // GGA
+  {0xF0, 0x01, 0},                                    // GLL
+  {0xF0, 0x02, 0},                                    // GSA
+  {0xF0, 0x03, 0},                                    // GSV
+  {0xF0, 0x05, 0},                                    // VTG
+};
+
+enum UbxState : byte { UBX_IDLE, UBX_SYNC, UBX_CLASS, UBX_ID, UBX_LENGTH_LOW, UBX_LENGTH_HIGH, UBX_PAYLOAD, UBX_CK_A, UBX_CK_B };
+#endif
+
+enum NmeaState : byte {
+  NMEA_IDLE,                                          // Waiting for '$'
+  NMEA_BODY,                                          // Between '$' and '*'
+  NMEA_CHECKSUM_HIGH,                                 // First hex digit of the checksum
+  NMEA_CHECKSUM_LOW,                                  // Second hex digit of the checksum
+};
+
+enum NmeaType : byte { NMEA_OTHER, NMEA_RMC, NMEA_ZDA };
+
+// Parser state
+byte nmeaState = NMEA_IDLE;
+byte nmeaType;                                        // NmeaType from the address field, e.g. "GNRMC"
+byte nmeaField;                                       // Index of the current field, 0 for the address field
+byte nmeaChar;                                        // Characters of the current field before a decimal point
+bool nmeaFraction;                                    // After the decimal point of the current field
+byte nmeaPairs[NMEA_DIGITS / 2];                      // Value of each pair of digits of the current field
+char nmeaLetter;                                      // Last letter of the current field
+char nmeaAddress[3];                                  // Sentence type after the talker ID in the address field
+byte nmeaChecksum;                                    // Xor over the characters between '$' and '*'
+byte nmeaReceived;                                    // Checksum given by the sentence
+
+// Contents of the current sentence
+bool nmeaHasTime;
+bool nmeaHasDate;
+byte nmeaHour, nmeaMinute, nmeaSecond;
+byte nmeaDay, nmeaMonth;
+unsigned int nmeaYear;
+char nmeaStatus;                                      // RMC status 'A' with a fix, 'V' without
+
+#ifdef UBX_TIMEPULSE
+// UBX parser state
+byte ubxState = UBX_IDLE;
+byte ubxClass;
+byte ubxId;
+unsigned int ubxLength;                               // Payload bytes of the current message
+unsigned int ubxIndex;                                // Payload bytes received
+byte ubxPayload[TIM_TP_LENGTH];                       // First bytes of the payload
+byte ubxCkA, ubxCkB;                                  // Fletcher checksum over class, id, length and payload
+
+// Quantization error of the next and of the last two GPS pulses
+bool nextErrorValid = false;
+long nextErrorQ8;
+bool pulseErrorValid = false;
+long pulseErrorQ8 = 0;
+long intervalErrorQ8 = 0;
+#endif
+
+// UTC time of the GPS pulses
+uint32_t pulseUtc = 0;                                // UTC second of the last GPS pulse, 0 while unknown
+bool pulseFix = false;
+bool pulseSeen = false;                               // pulseMicros is valid
+unsigned long pulseMicros;                            // lastGpsMicros of the last GPS pulse
+
+uint32_t gpsPulseUtc()
+{
+  return pulseUtc;
+}
+
+bool gpsPulseFix()
+{
+  return pulseFix;
+}
+
+long gpsPulseErrorQ8()
+{
+  #ifdef UBX_TIMEPULSE
+  return pulseErrorQ8;
+  #else
+  return 0;
+  #endif
+}
+
+long gpsIntervalErrorQ8()
+{
+  #ifdef UBX_TIMEPULSE
+  return intervalErrorQ8;
+  #else
+  return 0;
+  #endif
+}
+
+void tagGpsPulse(unsigned long gpsMicros)
+{
+  #ifdef UBX_TIMEPULSE
+  // Take the quantization error announced for this pulse, also for the interval since the previous one
+  intervalErrorQ8 = nextErrorValid && pulseErrorValid ? nextErrorQ8 - pulseErrorQ8 : 0;
+  pulseErrorValid = nextErrorValid;
+  pulseErrorQ8 = nextErrorValid ? nextErrorQ8 : 0;
+  nextErrorValid = false;
+  #endif
+
+  // Count the UTC second on over the seconds since the previous GPS pulse (a few after a holdover), with
+  // half a second of margin for the MCU clock and for spurious pulses in between
+  if (pulseUtc != 0) {
+    unsigned long interval = gpsMicros - pulseMicros;
+    if (interval > GPS_COUNT_MICROS) {
+      pulseUtc = 0;                                                 // wait for the next sentence
+    } else {
+      while (interval > 500000) {
+        pulseUtc++;
+        interval = interval > 1000000 ? interval - 1000000 : 0;
+      }
+    }
+  }
+  pulseSeen = true;
+  pulseMicros = gpsMicros;
+  if (pulseUtc != 0 && pulseUtc % 60 == 0) {
+    logTelemetry(TM_UTC, pulseUtc, 0, 0, pulseFix);
+  }
+}
+
+uint32_t utcSeconds()
+{
+  // Seconds since 1970 of the sentence contents, for the years 2000 up to 2099
+  unsigned int years = nmeaYear - 1970;
+  unsigned int days = years * 365 + (years + 1) / 4 + DAYS_BEFORE_MONTH[nmeaMonth - 1] + nmeaDay - 1;
+  if (nmeaMonth > 2 && nmeaYear % 4 == 0) {
+    days++;
+  }
+  return days * 86400UL + nmeaHour * 3600UL + nmeaMinute * 60U + nmeaSecond;
+}
+
+void startField()
+{
+  nmeaChar = 0;
+  nmeaFraction = false;
+  nmeaLetter = 0;
+  for (byte i = 0; i < NMEA_DIGITS / 2; i++) {
+    nmeaPairs[i] = 0;
+  }
+}
+
+void endField()
+{
+  // Take the digits or letter of a completed field that holds the time, date or status
+  if (nmeaField == 0) {
+    nmeaType = NMEA_OTHER;
+    if (nmeaChar == 5 && nmeaAddress[0] == 'R' && nmeaAddress[1] == 'M' && nmeaAddress[2] == 'C') {
+      nmeaType = NMEA_RMC;
+    } else if (nmeaChar == 5 && nmeaAddress[0] == 'Z' && nmeaAddress[1] == 'D' && nmeaAddress[2] == 'A') {
+      nmeaType = NMEA_ZDA;
+    }
+  } else if (nmeaField == 1 && nmeaType != NMEA_OTHER) {
+    nmeaHasTime = nmeaChar == 6 && nmeaPairs[0] < 24 && nmeaPairs[1] < 60 && nmeaPairs[2] < 60;
+    nmeaHour = nmeaPairs[0];
+    nmeaMinute = nmeaPairs[1];
+    nmeaSecond = nmeaPairs[2];
+  } else if (nmeaType == NMEA_RMC) {
+    if (nmeaField == 2) {
+      nmeaStatus = nmeaLetter;
+    } else if (nmeaField == 9) {
+      nmeaHasDate = nmeaChar == 6;
+      nmeaDay = nmeaPairs[0];
+      nmeaMonth = nmeaPairs[1];
+      nmeaYear = 2000 + nmeaPairs[2];
+    }
+  } else if (nmeaType == NMEA_ZDA) {
+    if (nmeaField == 2) {
+      nmeaDay = nmeaPairs[0];
+    } else if (nmeaField == 3) {
+      nmeaMonth = nmeaPairs[0];
+    } else if (nmeaField == 4) {
+      nmeaHasDate = nmeaChar == 4;
+      nmeaYear = nmeaPairs[0] * 100 + nmeaPairs[1];
+    }
+  }
+  nmeaField++;
+  startField();
+}
+
+void endSentence()
+{
+  // A sentence with a valid checksum describes the last GPS pulse if it completes within GPS_SENTENCE_MICROS
+  if (nmeaType == NMEA_OTHER) {
+    return;
+  }
+  bool fix = pulseFix;
+  if (nmeaType == NMEA_RMC) {
+    fix = nmeaStatus == 'A';
+  }
+  bool valid = nmeaHasTime && nmeaHasDate && nmeaYear >= 2000 && nmeaYear < 2100 && nmeaMonth >= 1 &&
+    nmeaMonth <= 12 && nmeaDay >= 1 && nmeaDay <= 31;
+  if (!valid || !pulseSeen || micros() - pulseMicros > GPS_SENTENCE_MICROS) {
+    return;
+  }
+  uint32_t utc = utcSeconds();
+  if (utc != pulseUtc || fix != pulseFix) {
+    logTelemetry(TM_UTC, utc, pulseUtc != 0 ? (int32_t)(utc - pulseUtc) : 0, 0, fix);
+  }
+  pulseUtc = utc;
+  pulseFix = fix;
+}
+
+byte hexValue(char c)
+{
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return 0xFF;
+}
+
+bool parseNmea(char c)
+{
+  // One step of the state machine, returns true when a sentence with a valid checksum completed
+  if (c == '$') {
+    nmeaState = NMEA_BODY;
+    nmeaChecksum = 0;
+    nmeaField = 0;
+    startField();
+    nmeaHasTime = false;
+    nmeaHasDate = false;
+    nmeaStatus = 0;
+    return false;
+  }
+  switch (nmeaState) {
+  case NMEA_BODY:
+    if (c == '*') {
+      endField();
+      nmeaState = NMEA_CHECKSUM_HIGH;
+      return false;
+    }
+    if (c < ' ' || c > '~') {
+      nmeaState = NMEA_IDLE;                                        // line end or garbage: incomplete sentence
+      return false;
+    }
+    nmeaChecksum ^= c;
+    if (c == ',') {
+      endField();
+    } else if (c == '.') {
+      nmeaFraction = true;
+    } else if (!nmeaFraction) {
+      if (nmeaField == 0 && nmeaChar >= 2 && nmeaChar < 5) {
+        nmeaAddress[nmeaChar - 2] = c;
+      } else if (c >= '0' && c <= '9' && nmeaChar < NMEA_DIGITS) {
+        byte &pair = nmeaPairs[nmeaChar / 2];
+        pair = pair * 10 + (c - '0');
+      } else {
+        nmeaLetter = c;
+      }
+      if (nmeaChar < 255) {
+        nmeaChar++;
+      }
+    }
+    return false;
+  case NMEA_CHECKSUM_HIGH:
+    nmeaReceived = hexValue(c);
+    nmeaState = nmeaReceived == 0xFF ? NMEA_IDLE : NMEA_CHECKSUM_LOW;
+    return false;
+  case NMEA_CHECKSUM_LOW:
+    nmeaState = NMEA_IDLE;
+    return hexValue(c) != 0xFF && ((nmeaReceived << 4) | hexValue(c)) == nmeaChecksum;
+  default:
+    return false;
+  }
+}
+
+#ifdef UBX_TIMEPULSE
+void sendUbx(byte msgClass, byte msgId, const byte *payload, unsigned int length)
+{
+  byte header[4] = {msgClass, msgId, (byte)(length & 0xFF), (byte)(length >> 8)};
+  byte ckA = 0;
+  byte ckB = 0;
+  Serial.write(UBX_SYNC1);
+  Serial.write(UBX_SYNC2);
+  for (unsigned int i = 0; i < 4 + length; i++) {
+    byte b = i < 4 ? header[i] : payload[i - 4];
+    Serial.write(b);
+    ckA += b;
+    ckB += ckA;
+  }
+  Serial.write(ckA);
+  Serial.write(ckB);
+}
+
+void endTimTp()
+{
+  // qErr in picoseconds at bytes 8-11, converted to 1/256 microseconds: * 256 / 1000000
+  long qErr = (long)((uint32_t)ubxPayload[8] | (uint32_t)ubxPayload[9] << 8 | (uint32_t)ubxPayload[10] << 16 |
+    (uint32_t)ubxPayload[11] << 24);
+  nextErrorValid = !(ubxPayload[14] & TIM_TP_QERR_INVALID);
+  nextErrorQ8 = qErr * 32 / 125000;
+}
+
+bool parseUbx(byte c)
+{
+  // One step of the state machine, returns true when a TIM-TP message with a valid checksum completed
+  switch (ubxState) {
+  case UBX_IDLE:
+    ubxState = c == UBX_SYNC1 ? UBX_SYNC : UBX_IDLE;
+    return false;
+  case UBX_SYNC:
+    ubxState = c == UBX_SYNC2 ? UBX_CLASS : UBX_IDLE;
+    ubxCkA = 0;
+    ubxCkB = 0;
+    return false;
+  case UBX_CK_A:
+    ubxState = c == ubxCkA ? UBX_CK_B : UBX_IDLE;
+    return false;
+  case UBX_CK_B:
+    ubxState = UBX_IDLE;
+    return c == ubxCkB && ubxClass == UBX_CLASS_TIM && ubxId == UBX_TIM_TP && ubxLength == TIM_TP_LENGTH;
+  default:
+    break;
+  }
+  ubxCkA += c;
+  ubxCkB += ubxCkA;
+  switch (ubxState) {
+  case UBX_CLASS:
+    ubxClass = c;
+    ubxState = UBX_ID;
+    break;
+  case UBX_ID:
+    ubxId = c;
+    ubxState = UBX_LENGTH_LOW;
+    break;
+  case UBX_LENGTH_LOW:
+    ubxLength = c;
+    ubxState = UBX_LENGTH_HIGH;
+    break;
+  case UBX_LENGTH_HIGH:
+    ubxLength |= (unsigned int)c << 8;
+    ubxIndex = 0;
+    ubxState = ubxLength > 0 ? UBX_PAYLOAD : UBX_CK_A;
+    break;
+  default:
+    if (ubxIndex < TIM_TP_LENGTH) {
+      ubxPayload[ubxIndex] = c;
+    }
+    if (++ubxIndex == ubxLength) {
+      ubxState = UBX_CK_A;
+    }
+  }
+  return false;
+}
+#endif
+
+bool gpsBytesReady()
+{
+  return Serial.available() > 0;
+}
+
+void setupGpsTime()
+{
+  // Blocking, for use in setup() only. Without UBX_TIMEPULSE the receiver keeps its own configuration.
+  addTask(pollGpsTime, GPS_TASK_MICROS, gpsBytesReady);
+  #ifdef UBX_TIMEPULSE
+  sendUbx(UBX_CLASS_CFG, UBX_CFG_TP5, CFG_TP5_PAYLOAD, sizeof(CFG_TP5_PAYLOAD));
+  for (byte i = 0; i < sizeof(CFG_MSG_PAYLOADS) / sizeof(CFG_MSG_PAYLOADS[0]); i++) {
+    sendUbx(UBX_CLASS_CFG, UBX_CFG_MSG, CFG_MSG_PAYLOADS[i], sizeof(CFG_MSG_PAYLOADS[i]));
+  }
+  Serial.println();                                                 // end of the UBX bytes in the serial monitor
+  #endif
+}
+
+void pollGpsTime()
+{
+  for (byte i = 0; i < GPS_POLL_BYTES && Serial.available() > 0; i++) {
+    byte c = Serial.read();
+    #ifdef UBX_TIMEPULSE
+    if (parseUbx(c)) {
+      endTimTp();
+      return;
+    }
+    #endif
+    if (parseNmea(c)) {
+      endSentence();
+      return;
+    }
+  }
+}
+
+#endif
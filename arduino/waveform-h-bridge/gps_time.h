@@ -0,0 +1,39 @@
+/*
+Optional UTC time of the GPS pulses, read from the NMEA sentences of the GPS receiver on the hardware
+UART (GPS TX to RX on D0), for absolute time tags in the telemetry and the SD card log.
+
+The receiver sends the RMC and ZDA sentences of a second after the GPS pulse at the start of that
+second. pollGpsTime() parses the received bytes one at a time with a small state machine, at most
+GPS_POLL_BYTES per call, so that it can run as a task of the scheduler in loop() (see scheduler.h)
+without delaying the syncing of the pulse train (see gps_time.cpp). tagGpsPulse() counts the UTC second on at each GPS
+pulse, which the next valid sentence confirms or corrects.
+
+Optionally (UBX_TIMEPULSE), setupGpsTime() configures the TIMEPULSE output of the receiver over UBX
+(GPS RX to TX on D1) and enables the UBX TIM-TP message. The receiver aligns its pulse to its own clock
+of a few tens of MHz, so each pulse has a quantization error of a few tens of nanoseconds, which TIM-TP
+reports before the pulse. The LCD shutter control subtracts it from the GPS pulses in the fractional
+bits of its clock discipline (see discipline() in gps_shutter_control.cpp).
+*/
+#ifndef GPS_TIME_H
+#define GPS_TIME_H
+
+#define GPS_TIME
+#undef GPS_TIME                                       // Outcomment to read the UTC time from the GPS receiver on RX (D0)
+#define UBX_TIMEPULSE
+#undef UBX_TIMEPULSE                                  // Outcomment to correct the GPS pulses by the TIM-TP quantization error (also TX (D1) to the receiver)
+
+#if defined(UBX_TIMEPULSE) && !defined(GPS_TIME)
+#error "UBX_TIMEPULSE needs GPS_TIME"
+#endif
+
+#include <stdint.h>
+
+void setupGpsTime();
+void pollGpsTime();
+void tagGpsPulse(unsigned long pulseMicros);
+uint32_t gpsPulseUtc();                               // UTC second of the last GPS pulse in seconds since 1970, 0 while unknown
+bool gpsPulseFix();                                   // Fix status of the last RMC sentence
+long gpsPulseErrorQ8();                               // Quantization error of the last GPS pulse in 1/256 microseconds, 0 if unknown
+long gpsIntervalErrorQ8();                            // Error of the interval up to the last GPS pulse, 0 if unknown
+
+#endif
@@ -0,0 +1,101 @@
+/*
+Timing histograms of the LCD shutter control (see profiler.h).
+
+profileSample() runs in the TIMER1 and GPS pulse interrupts as well as in loop(). Each metric is only
+sampled from one of them, so a histogram only needs protection against interrupts while the profiler
+task copies and resets it. The task sends one metric per run, as one TM_PROFILE record and the
+TM_PROFILE_BUCKETS records, and waits while the telemetry buffer has no room for all of them.
+*/
+#include "profiler.h"
+
+#ifdef PROFILER
+#include <arduino.h>
+#include "gps_time.h"
+#include "scheduler.h"
+#include "telemetry.h"
+
+const unsigned long PROFILE_TASK_MICROS = 400;        // Worst-case profilerTask(), encoding the records of one metric
+const unsigned long PROFILE_REPORT_MILLIS = 600000;   // Interval of the dumps with GPS_TIME (10 minutes)
+const byte PROFILE_RECORDS = 1 + (PROFILE_BUCKETS + PROFILE_FRAME_BUCKETS - 1) / PROFILE_FRAME_BUCKETS;
+
+struct ProfileHistogram {
+  uint16_t buckets[PROFILE_BUCKETS];
+  uint32_t samples;
+  uint32_t sum;
+  uint32_t max;
+};
+
+ProfileHistogram histograms[PROFILE_METRICS];
+byte dumpMetric = PROFILE_METRICS;                    // Next metric to send, PROFILE_METRICS while no dump is running
+#ifdef GPS_TIME
+unsigned long dumpMillis = 0;                         // millis() at the start of the previous dump
+#endif
+
+void profileSample(uint8_t metric, uint32_t value)
+{
+  ProfileHistogram &h = histograms[metric];
+  byte k = 0;
+  for (uint32_t v = value; v != 0 && k < PROFILE_BUCKETS - 1; v >>= 1) {
+    k++;
+  }
+  if (h.buckets[k] == 0xFFFF) {
+    for (byte i = 0; i < PROFILE_BUCKETS; i++) {
+      h.buckets[i] >>= 1;
+    }
+  }
+  h.buckets[k]++;
+  h.samples++;
+  h.sum += value;
+  h.max = max(h.max, value);
+}
+
+bool profilerReady()
+{
+  if (dumpMetric < PROFILE_METRICS) {
+    return true;
+  }
+  #ifdef GPS_TIME
+  return millis() - dumpMillis >= PROFILE_REPORT_MILLIS;
+  #else
+  return Serial.available() > 0;
+  #endif
+}
+
+void profilerTask()
+{
+  if (dumpMetric == PROFILE_METRICS) {
+    #ifdef GPS_TIME
+    dumpMillis = millis();
+    dumpMetric = 0;
+    #else
+    if (Serial.read() == PROFILE_COMMAND) {
+      dumpMetric = 0;
+    }
+    #endif
+    return;
+  }
+  if (telemetryRoom() < PROFILE_RECORDS) {
+    return;                                                         // wait for drainTelemetry()
+  }
+  ProfileHistogram h;
+  cli();
+  h = histograms[dumpMetric];
+  memset(&histograms[dumpMetric], 0, sizeof(ProfileHistogram));
+  sei();
+  logTelemetry(TM_PROFILE, h.samples, h.sum, h.max, dumpMetric);
+  for (byte k = 0; k < PROFILE_BUCKETS; k += PROFILE_FRAME_BUCKETS) {
+    uint16_t counts[PROFILE_FRAME_BUCKETS] = {};
+    for (byte i = 0; i < PROFILE_FRAME_BUCKETS && k + i < PROFILE_BUCKETS; i++) {
+      counts[i] = h.buckets[k + i];
+    }
+    logTelemetry(TM_PROFILE_BUCKETS, counts[0] | (uint32_t)counts[1] << 16, counts[2] | (uint32_t)counts[3] << 16,
+      counts[4] | (uint32_t)counts[5] << 16, dumpMetric | k << 8);
+  }
+  dumpMetric++;
+}
+
+void setupProfiler()
+{
+  addTask(profilerTask, PROFILE_TASK_MICROS, profilerReady);
+}
+#endif
@@ -0,0 +1,44 @@
+/*
+Optional profiler of the timing headroom of the LCD shutter control, for hard numbers before adding a
+station feature to loop().
+
+Each metric is collected into a histogram with logarithmic buckets: bucket 0 counts the value 0 and
+bucket k the values from 2^(k-1) up to 2^k - 1, the last bucket also all larger values. Besides the
+buckets, each metric keeps its number of samples, their sum and the largest value. When a bucket is
+full, all buckets of the metric are halved, so they keep the shape of the distribution.
+
+The timer metrics use TIMER1 values, so their resolution is 4 microseconds by default and 62.5
+nanoseconds with HIGH_RESOLUTION (see gps_shutter_control.h). The latency of the GPS pulse interrupt
+needs the input capture pin of TIMER1 (a wire between D2 and D8, as for PPS_CAPTURE); without it, that
+histogram stays empty.
+
+Sending PROFILE_COMMAND to the serial port dumps all histograms to the telemetry and resets them (see
+doc/arduino-programming.md). With GPS_TIME, the receive line belongs to the GPS receiver, so the
+histograms are dumped and reset every PROFILE_REPORT_MILLIS instead.
+*/
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#define PROFILER
+#undef PROFILER                                       // Outcomment to collect timing histograms, dumped with PROFILE_COMMAND
+
+#include <stdint.h>
+
+const uint8_t PROFILE_BUCKETS = 16;
+const uint8_t PROFILE_FRAME_BUCKETS = 6;              // Bucket counts per TM_PROFILE_BUCKETS record
+const char PROFILE_COMMAND = 'p';
+
+enum ProfileMetric : uint8_t {
+  PROFILE_ISR_LATENCY = 0,                            // TIMER1 ticks from the compare match up to the pin change in TIMER1_COMPA
+  PROFILE_ISR_DURATION,                               // TIMER1 ticks from the pin change up to the end of TIMER1_COMPA
+  PROFILE_GPS_LATENCY,                                // TIMER1 ticks from the GPS pulse up to its timestamp in the interrupt
+  PROFILE_SYNC,                                       // TIMER1 ticks from the GPS pulse up to the sync in run_shutter_control()
+  PROFILE_LOOP,                                       // Microseconds of one loop() iteration
+  PROFILE_METRICS
+};
+
+// Firmware side, in profiler.cpp
+void setupProfiler();
+void profileSample(uint8_t metric, uint32_t value);
+
+#endif
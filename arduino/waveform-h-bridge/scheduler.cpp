@@ -0,0 +1,117 @@
+/*
+Cooperative scheduler for the tasks in loop() (see scheduler.h).
+*/
+#include <arduino.h>
+#include "gps_shutter_control.h"
+#include "scheduler.h"
+#include "telemetry.h"
+#ifdef IDLE_SLEEP
+#include <avr/sleep.h>
+#endif
+
+const unsigned long TASK_REPORT_MILLIS = 600000;      // Interval of the task counters in the telemetry (10 minutes)
+
+Task tasks[MAX_TASKS];
+byte nTasks = 0;
+byte nextTask = 0;                                    // Task to try first at the next call (round robin)
+unsigned long reportMillis = 0;                       // millis() at the previous report of the task counters
+
+#ifdef IDLE_SLEEP
+unsigned long sleepMicros = 0;                        // Time asleep since the previous report, including the waking interrupts
+unsigned long wakeups = 0;
+#endif
+
+uint8_t addTask(void (*run)(), uint32_t costMicros, bool (*ready)())
+{
+  if (nTasks == MAX_TASKS) {
+    return MAX_TASKS;
+  }
+  tasks[nTasks] = {run, ready, costMicros, 0, 0, 0, 0, false};
+  return nTasks++;
+}
+
+uint8_t taskCount()
+{
+  return nTasks;
+}
+
+const Task &taskStats(uint8_t i)
+{
+  return tasks[i];
+}
+
+void reportTasks()
+{
+  #ifdef IDLE_SLEEP
+  unsigned long periodMillis = millis() - reportMillis;
+  logTelemetry(TM_SLEEP, sleepMicros / 1000, periodMillis, wakeups);
+  sleepMicros = 0;
+  wakeups = 0;
+  #endif
+  reportMillis = millis();
+  for (byte i = 0; i < nTasks; i++) {
+    logTelemetry(TM_TASK, tasks[i].worstMicros, tasks[i].overruns, tasks[i].deferrals, i);
+  }
+}
+
+#ifdef IDLE_SLEEP
+void idleSleep()
+{
+  // Interrupts stay disabled from the check of the deadline up to the sleep instruction, which runs before
+  // any interrupt after sei(), so an interrupt in between wakes the MCU right away instead of being missed
+  cli();
+  if (microsToDeadline() <= 0) {
+    sei();
+    return;
+  }
+  unsigned long startMicros = micros();
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  sleep_enable();
+  sei();
+  sleep_cpu();
+  sleep_disable();
+  sleepMicros += micros() - startMicros;
+  wakeups++;
+}
+#endif
+
+void runTasks()
+{
+  if (millis() - reportMillis >= TASK_REPORT_MILLIS) {
+    reportTasks();
+  }
+  // Try each task once, starting after the one that ran last, and run the first ready one that fits
+  for (byte n = 0; n < nTasks; n++) {
+    byte i = nextTask;
+    Task &task = tasks[i];
+    nextTask = i + 1 == nTasks ? 0 : i + 1;
+    if (task.ready && !task.ready()) {
+      continue;
+    }
+    long leftMicros = microsToDeadline();
+    if (leftMicros <= 0) {
+      return;                                                       // GPS pulse first
+    }
+    if (task.costMicros > (unsigned long)leftMicros) {
+      if (!task.deferred) {
+        task.deferred = true;
+        task.deferrals++;
+      }
+      continue;
+    }
+    unsigned long startMicros = micros();
+    task.run();
+    unsigned long runMicros = micros() - startMicros;
+    task.deferred = false;
+    task.runs++;
+    task.worstMicros = max(task.worstMicros, runMicros);
+    if (runMicros > task.costMicros) {
+      task.overruns++;
+      logTelemetry(TM_TASK_OVERRUN, runMicros, task.costMicros, 0, i);
+    }
+    return;
+  }
+  #ifdef IDLE_SLEEP
+  idleSleep();                                                      // No task ready, or none fits before the deadline
+  #endif
+}
@@ -0,0 +1,57 @@
+/*
+Cooperative scheduler for the tasks that share loop() with the LCD shutter control, e.g. the telemetry,
+the SD card log and the GPS time.
+
+Each task registers its worst-case execution time with addTask(). runTasks() runs at most one task per
+call, in turn, and only a task that fits before the deadline of the shutter control: the earliest
+moment at which the next GPS pulse is accepted in the locked state (see microsToDeadline() in
+gps_shutter_control.cpp). A GPS pulse waiting for run_shutter_control() ends runTasks() right away, so
+the syncing of the pulse train never waits for more than the task that is running.
+
+A task runs whenever its optional ready function returns true and it fits; without a ready function it
+is called each turn and returns right away when it has nothing to do. Each task counts its runs, its
+overruns (runs longer than its registered cost) and its deferrals (times that a ready task had to wait
+for the next GPS pulse). An overrun is logged at once, the counters every TASK_REPORT_MILLIS.
+
+Optionally (IDLE_SLEEP), runTasks() puts the MCU in the idle sleep mode when no task is ready, for
+stations on a battery or solar panel. Idle mode stops only the CPU clock: TIMER0, TIMER1, INT0 and the
+UART keep running, and any of their interrupts wakes the MCU, at the latest the TIMER0 overflow of
+millis() after 1024 microseconds. runTasks() does not sleep while a GPS pulse waits for
+run_shutter_control() or is due before its deadline (microsToDeadline() is not positive).
+
+Sleeping does add latency: an interrupt that wakes the MCU starts 4 cycles (0.25 microseconds) later than
+one that interrupts running code. This hits the timestamp of a GPS pulse that arrives during the sleep
+and, without OUTPUT_COMPARE, the PORTD write of each edge whose TIMER1 interrupt wakes the MCU, which is
+most of them. The delay is constant, of the order of the latency that running code adds depending on the
+instruction being executed, and far below a timer tick, but the edges do come 0.25 microseconds later than
+without IDLE_SLEEP. With OUTPUT_COMPARE, the compare match switches the pins in hardware and the edges
+stay where they are. The time asleep is reported along with the task counters.
+*/
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#define IDLE_SLEEP
+#undef IDLE_SLEEP                                     // Outcomment to sleep in between the interrupts when no task is ready
+
+#include <stdint.h>
+
+const uint8_t MAX_TASKS = 8;
+
+struct Task {
+  void (*run)();
+  bool (*ready)();                                    // Whether run() has work to do, nullptr for always
+  uint32_t costMicros;                                // Registered worst-case execution time
+  uint32_t runs;
+  uint32_t overruns;                                  // Runs that took longer than costMicros
+  uint32_t deferrals;                                 // Times that the ready task did not fit before the deadline
+  uint32_t worstMicros;                               // Longest run so far, including interrupts
+  bool deferred;                                      // Waiting since the last deferral
+};
+
+// Returns the task number, in order of registration, or MAX_TASKS if there is no room
+uint8_t addTask(void (*run)(), uint32_t costMicros, bool (*ready)() = nullptr);
+void runTasks();
+uint8_t taskCount();
+const Task &taskStats(uint8_t i);
+
+#endif
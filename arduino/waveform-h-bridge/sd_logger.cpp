@@ -0,0 +1,130 @@
+/*
+SD card logger (see sd_logger.h).
+
+The records of the GPS pulses fill a sector buffer in RAM. When it is full, it waits until the scheduler
+finds a moment for writing it to the card in one raw sector write (see sdLogTask() in
+gps_shutter_control.cpp): long enough before the next GPS pulse, and with the next TIMER1 compare match
+far enough away. Meanwhile, up to SD_SPARE_RECORDS new records wait in a small spare buffer, which is
+enough as the write normally follows within the same second. A sector write takes a few milliseconds,
+but occasionally the card is busy erasing flash for tens of milliseconds, which then still ends before
+the next GPS pulse. Every write is timed and the worst latency is reported in the telemetry and in the
+sector headers.
+
+The 2 KB of RAM of the ATmega328P have no room for a second sector buffer next to the file system: the
+SdFat32 object with its sector cache takes about 600 bytes. The file system is only used in setupSdLog()
+for creating a contiguous, preallocated log file; after that, its cache serves as the sector buffer and
+its card object does the raw sector writes.
+*/
+#include "sd_logger.h"
+
+#ifdef SD_LOG
+#include <arduino.h>
+#include <SPI.h>
+#include <SdFat.h>
+#include "telemetry.h"
+
+const uint32_t SD_LOG_SECTORS = 4096;                 // Preallocated size of a log file (2 MB, 27 hours of records)
+const uint8_t SD_SPARE_RECORDS = 4;                   // Records that wait while the full sector buffer is written
+
+SdFat32 sd;                                           // File system in setupSdLog(), raw sector access after it
+bool sdActive = false;                                // Log file available and not full
+uint32_t sdFirstSector;                               // First sector of the log file on the card
+uint32_t sdSector = 0;                                // Index of the next sector to write in the log file
+byte *sdBuffer;                                       // The sector cache of sd, after setupSdLog()
+byte nSdRecords = 0;                                  // Records in sdBuffer
+bool sdReady = false;                                 // sdBuffer is full and waits for writing
+SdRecord sdSpare[SD_SPARE_RECORDS];                   // Records that arrived while sdReady
+byte nSdSpare = 0;
+uint16_t sdDropped = 0;
+uint32_t sdWorstMicros = 0;
+
+void setupSdLog()
+{
+  File32 file;
+  char name[13];
+  if (!sd.begin(SdSpiConfig(SD_CS_PIN, SHARED_SPI, SD_SCK_MHZ(4)))) {
+    Serial.println(F("SD log: no card"));
+    return;
+  }
+  for (unsigned int i = 1; i < 1000 && !file; i++) {
+    snprintf_P(name, sizeof(name), PSTR("PHASE%03u.BIN"), i);
+    if (!sd.exists(name)) {
+      file.open(name, O_RDWR | O_CREAT);
+    }
+  }
+  uint32_t lastSector;
+  if (!file || !file.preAllocate(SD_LOG_SECTORS * SD_SECTOR_SIZE) ||
+      !file.contiguousRange(&sdFirstSector, &lastSector) || !file.close()) {
+    Serial.println(F("SD log: cannot create a log file"));
+    return;
+  }
+  // The file system must not touch its cache from here on
+  sdBuffer = sd.cacheClear();
+  if (!sdBuffer) {
+    Serial.println(F("SD log: cannot create a log file"));
+    return;
+  }
+  memset(sdBuffer, 0, SD_SECTOR_SIZE);                              // no file system data in the unused bytes
+  sdActive = true;
+  Serial.print(F("SD log: "));
+  Serial.println(name);
+}
+
+void finishSector()
+{
+  // Completes the header of the full buffer and hands it over for writing
+  SdSectorHeader header = {SD_MAGIC, sdSector, sdWorstMicros, sdDropped, nSdRecords, 0};
+  memcpy(sdBuffer, &header, sizeof(header));
+  sdReady = true;
+}
+
+void logSdRecord(const SdRecord &record)
+{
+  if (!sdActive) {
+    return;
+  }
+  if (sdReady) {
+    if (nSdSpare == SD_SPARE_RECORDS) {
+      sdDropped++;                                                  // the card is too slow, or the writes are deferred
+      return;
+    }
+    sdSpare[nSdSpare++] = record;
+    return;
+  }
+  memcpy(sdBuffer + sizeof(SdSectorHeader) + nSdRecords * sizeof(SdRecord), &record, sizeof(SdRecord));
+  if (++nSdRecords == SD_RECORDS) {
+    finishSector();
+  }
+}
+
+bool sdSectorReady()
+{
+  return sdActive && sdReady;
+}
+
+void writeSdLog()
+{
+  if (!sdReady) {
+    return;
+  }
+  unsigned long startMicros = micros();
+  bool written = sd.card()->writeSector(sdFirstSector + sdSector, sdBuffer);
+  unsigned long writeMicros = micros() - startMicros;
+  sdWorstMicros = max(sdWorstMicros, writeMicros);
+  if (!written || ++sdSector == SD_LOG_SECTORS) {
+    // No more writes: past the end of the file, or again and again to a failing card
+    sdActive = false;
+    sdReady = false;
+    nSdRecords = 0;
+    nSdSpare = 0;
+    logTelemetry(TM_SD_STOPPED, sdSector);
+    return;
+  }
+  logTelemetry(TM_SD_WRITE, sdSector, writeMicros, sdWorstMicros, sdDropped);
+  // The spare records start the next sector
+  memcpy(sdBuffer + sizeof(SdSectorHeader), sdSpare, nSdSpare * sizeof(SdRecord));
+  nSdRecords = nSdSpare;
+  nSdSpare = 0;
+  sdReady = false;
+}
+#endif
@@ -0,0 +1,61 @@
+/*
+Optional logging of one record per GPS pulse on an SD card, for validating the second markers of a
+whole night against other stations afterwards.
+
+The records are collected in a RAM sector buffer, with a few spare records for the time that a full
+sector waits for being written to the card (see sd_logger.cpp). Each sector of the log file holds a
+header and 24 records:
+
+  SdSectorHeader      16 bytes
+  SdRecord[24]        20 bytes each
+  unused              16 bytes
+
+The layouts are the same on the Arduino and on a PC, for the decoder in arduino/telemetry-decoder.
+*/
+#ifndef SD_LOGGER_H
+#define SD_LOGGER_H
+
+#define SD_LOG
+#undef SD_LOG                                         // Outcomment to log the GPS pulses on an SD card (chip select on D5)
+
+#include <stdint.h>
+
+const uint8_t SD_CS_PIN = 5;                          // Chip select of the SD card reader on the PCB (see explore/test-sdfat)
+const uint16_t SD_SECTOR_SIZE = 512;
+const uint8_t SD_RECORDS = 24;                        // Records per sector after the header
+const uint32_t SD_MAGIC = 0x4C534850;                 // "PHSL" in the first bytes of each written sector
+
+enum SdState : uint8_t {
+  SD_CALIBRATING = 0,                                 // Before the STABLE state, no phase available
+  SD_LOCKED,                                          // STABLE state, phaseTicks used for the clock discipline
+  SD_HOLDOVER_END,                                    // First GPS pulse after a holdover
+  SD_REJECTED,                                        // GPS pulse rejected outside PULSE_WINDOW
+};
+const uint8_t SD_FIX = 0x80;                          // Flag in SdRecord::state: GPS fix at the last RMC sentence (GPS_TIME)
+
+struct SdSectorHeader {
+  uint32_t magic;                                     // SD_MAGIC
+  uint32_t sector;                                    // Index of the sector in the log file
+  uint32_t worstMicros;                               // Worst sector write latency so far
+  uint16_t dropped;                                   // Records dropped so far because both buffers were full
+  uint8_t nRecords;                                   // Valid records in the sector
+  uint8_t reserved;
+} __attribute__((packed));
+
+struct SdRecord {
+  uint32_t gpsPulse;                                  // iGpsPulse, counted from the start of the preliminary calibration
+  uint32_t gpsMicros;                                 // micros() at the GPS pulse
+  uint32_t freq;                                      // calibratedFreq
+  uint32_t utc;                                       // UTC second of the GPS pulse since 1970, 0 if unknown (GPS_TIME)
+  int16_t phaseTicks;                                 // Ticks that the previous pulse train ended before the GPS pulse
+  uint8_t state;                                      // SdState, with SD_FIX
+  uint8_t trainIsrs;                                  // Half wave interrupts of the pulse train that the GPS pulse ended, up to 255
+} __attribute__((packed));
+
+// Firmware side, in sd_logger.cpp
+void setupSdLog();
+void logSdRecord(const SdRecord &record);
+bool sdSectorReady();
+void writeSdLog();
+
+#endif
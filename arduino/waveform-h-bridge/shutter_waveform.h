@@ -0,0 +1,204 @@
+/*
+Compile-time description of the waveform for the LCD shutters and of the driver circuit that applies it.
+
+A pulse train of one second consists of SHUTTER_HZ waves. In each wave, every channel (an LCD shutter with its
+own driver inputs) gets one pulse, a voltage on the shutter for shutPercentage of the wave, and has its shutter
+terminals shortcut for the rest of the wave. Successive pulses of a channel alternate between negative on its
+PIN_NEG and positive on its PIN_POS, so the number of waves has to be even to keep the shutters free of a DC
+voltage. In the locked state, the pulses of the waves in MARKER_WAVES are left out (bit k for wave k), which
+marks these moments in the images; bit 0 gives the second marker at the GPS pulse.
+
+The pulses of the first channel start at the start of each wave. Each other channel may start its pulses
+offsetPercentage of a wave later, e.g. to interleave the exposures of several cameras; a pulse may then run
+into the next wave. All channels share the GPS lock and TIMER1: the edges of all channels split each wave
+into EDGES_PER_WAVE parts, and the TIMER1 interrupt sets the pins of all channels at the start of each part
+with a single PORTD write. With one channel, these parts are the shut and the open half wave, which is why
+gps_shutter_control.cpp calls every part a half wave, also with more channels. Edges of different channels
+at the same percentage of the wave share a part, so they switch simultaneously.
+
+How the terminals are shortcut depends on the driver:
+ - H-bridge (TB6612 module): both inputs high, the slow decay mode that lets the shutter become transparent
+ - opamp (reference design with TL074, OPAMP_DRIVER): both inputs low, so that the final opamp outputs 0 V
+
+Waveform<> turns these parameters into the constants of the pulse train and the pin values per part of a
+wave, all evaluated by the compiler, so that gps_shutter_control.cpp has the same code path for every
+variant. The timer period of a wave has to fit TIMER1: lower shutter frequencies need HIGH_RESOLUTION (see
+gps_shutter_control.h) or a larger prescaler.
+*/
+#ifndef SHUTTER_WAVEFORM_H
+#define SHUTTER_WAVEFORM_H
+
+#define OPAMP_DRIVER
+#undef OPAMP_DRIVER                                   // Outcomment to drive an opamp-based driver instead of the H-bridge
+
+#include <stdint.h>
+#include <string.h>
+
+const uint8_t SHUTTER_HZ = 16;                        // Waves per second, e.g. 10, 16 or 20 to match the lens
+const uint32_t MARKER_WAVES = 0x00000001;             // Waves without a pulse in the locked state (bit 0: second marker)
+
+struct ShutterChannel {
+  uint8_t pinNeg;                                     // Driver input for the negative pulses, D3 - D7 (on PORTD)
+  uint8_t pinPos;                                     // Driver input for the positive pulses, D3 - D7 (on PORTD)
+  uint8_t shutPercentage;                             // Percentage of time that the LCD shutter receives a voltage (15 - 70)
+  uint8_t offsetPercentage;                           // Start of the pulses in percent of a wave after those of the first channel
+};
+
+// User editable, one line per LCD shutter. Advised shutPercentage values:
+//  - standard grade LCtec shutters:   25
+//  - fast X-grade LCtec shutters:     50
+// D5 is the chip select of the SD card reader with SD_LOG (see sd_logger.h).
+const uint8_t N_CHANNEL = 1;
+constexpr ShutterChannel SHUTTER_CHANNELS[N_CHANNEL] = {
+  {3, 4, 25, 0},
+  // {6, 7, 50, 50},
+};
+
+constexpr bool channelsValid(const ShutterChannel *channel, uint8_t n, uint8_t usedPins)
+{
+  return n == 0 || (
+    channel->pinNeg >= 3 && channel->pinNeg <= 7 && channel->pinPos >= 3 && channel->pinPos <= 7 &&
+    channel->pinNeg != channel->pinPos && (usedPins & (1 << channel->pinNeg | 1 << channel->pinPos)) == 0 &&
+    channel->shutPercentage >= 15 && channel->shutPercentage <= 70 && channel->offsetPercentage < 100 &&
+    channelsValid(channel + 1, n - 1, usedPins | 1 << channel->pinNeg | 1 << channel->pinPos));
+}
+static_assert(channelsValid(SHUTTER_CHANNELS, N_CHANNEL, 0),
+  "SHUTTER_CHANNELS needs distinct pins D3 - D7, a shutPercentage of 15 - 70 and an offsetPercentage below 100");
+static_assert(SHUTTER_CHANNELS[0].offsetPercentage == 0, "the pulses of the first channel start at the start of a wave");
+
+struct HBridgeDriver {
+  static constexpr uint8_t shortcut(uint8_t neg, uint8_t pos) { return neg | pos; }  // slow decay mode of the H-bridge
+};
+
+struct OpampDriver {
+  static constexpr uint8_t shortcut(uint8_t, uint8_t) { return 0; }  // 0 V on the output of the final opamp
+};
+
+// Numbers 0, 1, ..., N - 1 as a template parameter pack, for filling the tables below
+template <uint8_t... I>
+struct Indices {};
+template <uint8_t N, uint8_t... I>
+struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {};
+template <uint8_t... I>
+struct MakeIndices<0, I...> {
+  typedef Indices<I...> type;
+};
+
+// Percentage of the wave at which the pulse of channel c starts (end false) or ends (end true)
+constexpr uint8_t channelEdge(uint8_t c, bool end)
+{
+  return end ? (SHUTTER_CHANNELS[c].offsetPercentage + SHUTTER_CHANNELS[c].shutPercentage) % 100 :
+    SHUTTER_CHANNELS[c].offsetPercentage;
+}
+
+constexpr uint8_t lower(uint8_t a, uint8_t b)
+{
+  return a < b ? a : b;
+}
+
+// Smallest edge of the channels from c on above percentage p, 100 if none
+constexpr uint8_t edgeAbove(uint8_t p, uint8_t c = 0)
+{
+  return c == N_CHANNEL ? 100 : lower(lower(channelEdge(c, false) > p ? channelEdge(c, false) : 100,
+    channelEdge(c, true) > p ? channelEdge(c, true) : 100), edgeAbove(p, c + 1));
+}
+
+constexpr uint8_t countEdges(uint8_t p)
+{
+  return p >= 100 ? 0 : 1 + countEdges(edgeAbove(p));
+}
+
+// Percentage of the wave at which part k of the wave starts; part 0 starts with the pulses of the first channel
+constexpr uint8_t partStart(uint8_t k, uint8_t p = 0)
+{
+  return k == 0 ? p : partStart(k - 1, edgeAbove(p));
+}
+
+const uint8_t EDGES_PER_WAVE = countEdges(0);         // Parts of a wave between the edges of all channels
+
+// Shortest part of a wave in percent, for checking the timer periods
+constexpr uint8_t shortestPart(uint8_t k = 0)
+{
+  return k == EDGES_PER_WAVE ? 100 :
+    lower((k + 1 < EDGES_PER_WAVE ? partStart(k + 1) : 100) - partStart(k), shortestPart(k + 1));
+}
+
+// Outputs gives the pin masks of channel c as Outputs::neg(c) and Outputs::pos(c)
+template <class Driver, class Outputs, uint8_t HZ, uint32_t MARKERS>
+struct Waveform {
+  static_assert(HZ % 2 == 0, "an odd number of waves puts a DC voltage on the shutter");
+  static_assert(HZ <= 32, "MARKER_WAVES has one bit per wave");
+  static_assert(HZ * EDGES_PER_WAVE <= 128, "the schedule tables of this many edges per second do not fit the RAM");
+
+  static constexpr uint8_t N_WAVE = HZ;
+  static constexpr uint8_t N_HALF_WAVE = N_WAVE * EDGES_PER_WAVE;
+  static constexpr bool POWER_OF_2 = (N_HALF_WAVE & (N_HALF_WAVE - 1)) == 0;
+
+  // Half wave after i; a mask when N_HALF_WAVE is a power of 2, so the TIMER1 interrupt has no branch then
+  static constexpr uint8_t next(uint8_t i)
+  {
+    return POWER_OF_2 ? (i + 1) & (N_HALF_WAVE - 1) : (i + 1 == N_HALF_WAVE ? 0 : i + 1);
+  }
+
+  // Number of half waves from half wave j up to half wave i, modulo N_HALF_WAVE
+  static constexpr uint8_t distance(uint8_t j, uint8_t i)
+  {
+    return POWER_OF_2 ? (i - j) & (N_HALF_WAVE - 1) : (i + N_HALF_WAVE - j) % N_HALF_WAVE;
+  }
+
+  // Pin values of channel c at percentage p of wave w: a pulse, negative in odd waves and positive in even
+  // waves, unless left out for a marker, else the shortcut of the driver
+  static constexpr uint8_t channelPins(uint8_t c, uint8_t w, uint8_t p, bool markers)
+  {
+    return (p + 100 - SHUTTER_CHANNELS[c].offsetPercentage) % 100 >= SHUTTER_CHANNELS[c].shutPercentage ?
+      Driver::shortcut(Outputs::neg(c), Outputs::pos(c)) :
+      pulsePins(c, p >= SHUTTER_CHANNELS[c].offsetPercentage ? w : (w + N_WAVE - 1) % N_WAVE, markers);
+  }
+
+  static constexpr uint8_t pulsePins(uint8_t c, uint8_t w, bool markers)
+  {
+    return markers && (MARKERS >> w & 1) ? Driver::shortcut(Outputs::neg(c), Outputs::pos(c)) :
+      w % 2 == 1 ? Outputs::neg(c) : Outputs::pos(c);
+  }
+
+  static constexpr uint8_t pins(uint8_t i, bool markers, uint8_t c = 0)
+  {
+    return c == N_CHANNEL ? 0 :
+      channelPins(c, i / EDGES_PER_WAVE, partStart(i % EDGES_PER_WAVE), markers) | pins(i, markers, c + 1);
+  }
+
+  // All pins of the channels, e.g. for masking PORTD
+  static constexpr uint8_t outputs(uint8_t c = 0)
+  {
+    return c == N_CHANNEL ? 0 : Outputs::neg(c) | Outputs::pos(c) | outputs(c + 1);
+  }
+
+  // Copy the pin values of all half waves, with or without the markers, from tables built by the compiler
+  static void copyPins(uint8_t *table, bool markers)
+  {
+    copyPins(table, markers, typename MakeIndices<N_HALF_WAVE>::type());
+  }
+
+  template <uint8_t... I>
+  static void copyPins(uint8_t *table, bool markers, Indices<I...>)
+  {
+    static constexpr uint8_t freeRunning[] = {pins(I, false)...};
+    static constexpr uint8_t locked[] = {pins(I, true)...};
+    memcpy(table, markers ? locked : freeRunning, N_HALF_WAVE);
+  }
+
+  // Percentage of the wave at which part k starts, from a table built by the compiler
+  static uint8_t partPercentage(uint8_t k)
+  {
+    return partPercentage(k, typename MakeIndices<EDGES_PER_WAVE>::type());
+  }
+
+  template <uint8_t... I>
+  static uint8_t partPercentage(uint8_t k, Indices<I...>)
+  {
+    static constexpr uint8_t starts[] = {partStart(I)...};
+    return starts[k];
+  }
+};
+
+#endif
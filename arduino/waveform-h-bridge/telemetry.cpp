@@ -0,0 +1,121 @@
+/*
+Ring buffer of telemetry frames (see telemetry.h), filled by the LCD shutter control and drained to
+the serial port in between the TIMER1 interrupts.
+
+The control path only encodes a frame of 18 bytes into RAM, instead of formatting text and waiting in
+Serial.println() until the UART has sent most of it (about 1 millisecond per character at 9600 baud).
+The UART data register empty interrupt, which feeds the next byte to the UART, can delay the TIMER1
+interrupt by a few microseconds. Therefore, drainTelemetry() only hands over the bytes that the UART
+can send before the next edge of the pulse train (the blanking window); the rest waits for the next
+half wave. This also keeps the UART quiet at the end of each pulse train, when the GPS pulse arrives.
+*/
+#define TEXT_LOG
+#undef TEXT_LOG                                       // Outcomment to send log text instead of frames, for the serial monitor of the Arduino IDE
+
+#include <arduino.h>
+#include "gps_shutter_control.h"
+#include "telemetry.h"
+
+const unsigned long BYTE_TICKS = 16667 / PRESCALER + 1;  // TIMER1 ticks per byte at 9600 baud (see waveform-h-bridge.ino), 10 bits per byte
+const unsigned long DRAIN_MARGIN = 1600 / PRESCALER;  // TIMER1 ticks (100 microseconds) reserved for the UART interrupt and drainTelemetry() itself
+
+// Single producer, single consumer: only logTelemetry() moves ringHead and only drainTelemetry() moves
+// ringTail. Both are single bytes, so they are read and written atomically without disabling interrupts.
+// With 256 bytes the indices wrap around by themselves.
+byte ring[256];                                       // Encoded frames
+volatile byte ringHead = 0;                           // Next byte to write
+volatile byte ringTail = 0;                           // Next byte to send
+byte telemetrySeq = 0;                                // Sequence number of the next record
+
+#ifdef TEXT_LOG
+char text[RECORD_TEXT_SIZE + 2];                      // Log text of the frame being sent, with "\r\n"
+byte textLength = 0;
+byte textSent = 0;
+#endif
+
+void logTelemetry(uint8_t type, int32_t a, int32_t b, int32_t c, uint16_t d)
+{
+  TelemetryRecord record = {type, telemetrySeq++, a, b, c, d};
+  byte head = ringHead;
+  if ((byte)(ringTail - head - 1) < FRAME_SIZE) {
+    return;                                                         // buffer full, the decoder sees the gap in seq
+  }
+  byte frame[FRAME_SIZE];
+  encodeFrame(record, frame);
+  for (byte i = 0; i < FRAME_SIZE; i++) {
+    ring[head++] = frame[i];
+  }
+  ringHead = head;                                                  // publish the frame after it is complete
+}
+
+bool nextByte(byte &c)
+{
+  // Next byte for the UART, or false if there is none
+  #ifdef TEXT_LOG
+  if (textSent == textLength) {
+    if (ringTail == ringHead) {
+      return false;
+    }
+    byte frame[FRAME_SIZE];
+    byte tail = ringTail;
+    for (byte i = 0; i < FRAME_SIZE; i++) {
+      frame[i] = ring[tail++];
+    }
+    ringTail = tail;
+    TelemetryRecord record;
+    decodeFrame(frame, record);
+    int n = min(formatRecord(record, text, RECORD_TEXT_SIZE), RECORD_TEXT_SIZE - 1);
+    text[n++] = '\r';
+    text[n++] = '\n';
+    textLength = n;
+    textSent = 0;
+  }
+  c = text[textSent++];
+  #else
+  if (ringTail == ringHead) {
+    return false;
+  }
+  c = ring[ringTail];
+  ringTail = ringTail + 1;
+  #endif
+  return true;
+}
+
+void drainTelemetry()
+{
+  unsigned long ticksLeft = ticksToCompare();
+  if (ticksLeft < DRAIN_MARGIN) {
+    return;
+  }
+  // Bytes still in the transmit buffer of HardwareSerial go first, plus one in the UART itself
+  int pending = SERIAL_TX_BUFFER_SIZE - Serial.availableForWrite();
+  int nBytes = (int)((ticksLeft - DRAIN_MARGIN) / BYTE_TICKS) - pending;
+  byte c;
+  while (nBytes-- > 0 && nextByte(c)) {
+    Serial.write(c);
+  }
+}
+
+bool telemetryPending()
+{
+  #ifdef TEXT_LOG
+  if (textSent != textLength) {
+    return true;
+  }
+  #endif
+  return ringTail != ringHead;
+}
+
+uint8_t telemetryRoom()
+{
+  return (byte)(ringTail - ringHead - 1) / FRAME_SIZE;
+}
+
+void flushTelemetry()
+{
+  // Blocking, for use outside the control path only, e.g. in setup()
+  byte c;
+  while (nextByte(c)) {
+    Serial.write(c);
+  }
+}
@@ -0,0 +1,87 @@
+/*
+Binary telemetry of the LCD shutter control, replacing the formatting of log text and the blocking
+Serial.println() calls in the control path.
+
+Events are written as fixed-size frames into a ring buffer (see telemetry.cpp), which is drained to
+the serial port only in between the TIMER1 interrupts. Each frame has the layout:
+
+  byte 0       TELEMETRY_SYNC
+  byte 1       record type (TelemetryType)
+  byte 2       sequence number, incremented per record, also for records dropped on a full buffer
+  bytes 3-14   fields a, b and c (32 bits each, little endian)
+  bytes 15-16  field d (16 bits, little endian)
+  byte 17      checksum over bytes 1-16
+
+The frame coding and formatRecord() in telemetry_format.cpp do not depend on the Arduino core, so that
+the host decoder in arduino/telemetry-decoder turns the frames back into the log text of older versions.
+*/
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+const uint8_t TELEMETRY_SYNC = 0xA5;                  // Start of a frame, not a valid character in log text
+const uint8_t FRAME_SIZE = 18;                        // Bytes per frame, including sync and checksum
+const uint8_t RECORD_TEXT_SIZE = 120;                 // Large enough for the text of any record
+
+enum TelemetryType : uint8_t {
+  TM_PHASE = 1,                                       // a: iIsr, b: observedTicks, c: oldHalfWave, d: oldTCNT1
+  TM_CALIBRATION,                                     // a: calibration micros, b: MCU frequency, c: train ticks
+  TM_RESIDUAL,                                        // a: residual ticks, b: MCU frequency, c: GPS pulse error in 1/256 microseconds
+  TM_SAVED,                                           // a: MCU frequency, b: age, d: variance
+  TM_AVOIDANCE,                                       // a: OCR1A, b: TCNT1
+  TM_INTERVAL,                                        // a: unexpected GPS pulse interval in microseconds
+  TM_WARM_REJECTED,                                   // a: deviation in microseconds
+  TM_WARM_START,
+  TM_REJECTED,                                        // a: phase in ticks
+  TM_HOLDOVER_START,
+  TM_HOLDOVER_END,                                    // a: seconds, b: phase in ticks, c: bound in microseconds
+  TM_LOCK_LOST,
+  TM_SD_WRITE,                                        // a: sectors written, b: write micros, c: worst micros, d: dropped records
+  TM_SD_STOPPED,                                      // a: sectors written
+  TM_UTC,                                             // a: UTC second of the GPS pulse since 1970, b: correction in seconds, d: fix
+  TM_TASK,                                            // a: worst micros, b: overruns, c: deferrals, d: task number
+  TM_TASK_OVERRUN,                                    // a: run micros, b: registered cost in micros, d: task number
+  TM_PROFILE,                                         // a: samples, b: sum, c: max, d: ProfileMetric (see profiler.h)
+  TM_PROFILE_BUCKETS,                                 // a, b, c: two 16-bit bucket counts each, d: ProfileMetric | first bucket << 8
+  TM_SLEEP,                                           // a: millis asleep, b: millis since the previous report, c: wake-ups
+};
+
+struct TelemetryRecord {
+  uint8_t type;
+  uint8_t seq;
+  int32_t a;
+  int32_t b;
+  int32_t c;
+  uint16_t d;
+};
+
+// Frame coding and log text, shared with the host decoder
+void encodeFrame(const TelemetryRecord &record, uint8_t *frame);
+bool decodeFrame(const uint8_t *frame, TelemetryRecord &record);
+int formatRecord(const TelemetryRecord &record, char *text, size_t size);
+
+// Incremental decoder of a serial stream with frames mixed with plain log text (e.g. from setup())
+struct TelemetryDecoder {
+  char line[RECORD_TEXT_SIZE];                        // Complete line of text or the text of a record
+  uint8_t nLine = 0;
+  uint8_t frame[FRAME_SIZE];                          // Bytes of a possible frame
+  uint8_t nFrame = 0;
+  uint8_t nextSeq = 0;
+  bool synced = false;                                // nextSeq is valid after the first frame
+  uint32_t lost = 0;                                  // Records dropped on the MCU, from the sequence numbers
+
+  // Returns true when line holds a complete line of log text, which is several lines separated by '\n'
+  // for some records
+  bool push(uint8_t c);
+};
+
+// Firmware side, in telemetry.cpp
+void logTelemetry(uint8_t type, int32_t a = 0, int32_t b = 0, int32_t c = 0, uint16_t d = 0);
+void drainTelemetry();
+bool telemetryPending();                              // Whether drainTelemetry() has bytes to send
+void flushTelemetry();
+uint8_t telemetryRoom();                              // Records that fit in the buffer
+
+#endif
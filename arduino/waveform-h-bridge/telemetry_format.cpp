@@ -0,0 +1,211 @@
+/*
+Frame coding and log text of the telemetry records (see telemetry.h). This file does not use the
+Arduino core, because the host decoder and the simulator compile it as well.
+*/
+#include <stdio.h>
+#include "telemetry.h"
+#include "profiler.h"
+
+static void putLittleEndian(uint8_t *bytes, uint32_t value, uint8_t n)
+{
+  for (uint8_t i = 0; i < n; i++) {
+    bytes[i] = value >> (8 * i);
+  }
+}
+
+static uint32_t getLittleEndian(const uint8_t *bytes, uint8_t n)
+{
+  uint32_t value = 0;
+  for (uint8_t i = 0; i < n; i++) {
+    value |= (uint32_t)bytes[i] << (8 * i);
+  }
+  return value;
+}
+
+static uint8_t frameChecksum(const uint8_t *frame)
+{
+  // Rotate and xor over the bytes between sync and checksum, like the EEPROM records
+  uint8_t checksum = TELEMETRY_SYNC;
+  for (uint8_t i = 1; i < FRAME_SIZE - 1; i++) {
+    checksum = ((checksum << 1) | (checksum >> 7)) ^ frame[i];
+  }
+  return checksum;
+}
+
+void encodeFrame(const TelemetryRecord &record, uint8_t *frame)
+{
+  frame[0] = TELEMETRY_SYNC;
+  frame[1] = record.type;
+  frame[2] = record.seq;
+  putLittleEndian(frame + 3, record.a, 4);
+  putLittleEndian(frame + 7, record.b, 4);
+  putLittleEndian(frame + 11, record.c, 4);
+  putLittleEndian(frame + 15, record.d, 2);
+  frame[FRAME_SIZE - 1] = frameChecksum(frame);
+}
+
+bool decodeFrame(const uint8_t *frame, TelemetryRecord &record)
+{
+  if (frame[0] != TELEMETRY_SYNC || frame[FRAME_SIZE - 1] != frameChecksum(frame)) {
+    return false;
+  }
+  record.type = frame[1];
+  record.seq = frame[2];
+  record.a = getLittleEndian(frame + 3, 4);
+  record.b = getLittleEndian(frame + 7, 4);
+  record.c = getLittleEndian(frame + 11, 4);
+  record.d = getLittleEndian(frame + 15, 2);
+  return true;
+}
+
+static int formatUtc(uint32_t utc, char *text, size_t size)
+{
+  // Date and time of the seconds since 1970, by counting years and months (no time functions on the MCU)
+  static const uint8_t DAYS_IN_MONTH[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+  uint32_t days = utc / 86400;
+  uint32_t seconds = utc % 86400;
+  unsigned int year = 1970;
+  while (days >= (year % 4 == 0 ? 366U : 365U)) {
+    days -= year % 4 == 0 ? 366 : 365;
+    year++;
+  }
+  unsigned int month = 0;
+  while (days >= DAYS_IN_MONTH[month] + (month == 1 && year % 4 == 0 ? 1U : 0U)) {
+    days -= DAYS_IN_MONTH[month] + (month == 1 && year % 4 == 0 ? 1 : 0);
+    month++;
+  }
+  return snprintf(text, size, "%04u-%02u-%02u %02u:%02u:%02u", year, month + 1, (unsigned int)days + 1,
+    (unsigned int)(seconds / 3600), (unsigned int)(seconds / 60 % 60), (unsigned int)(seconds % 60));
+}
+
+static const char *profileMetricName(uint32_t metric)
+{
+  static const char *const NAMES[PROFILE_METRICS] = {"ISR latency", "ISR duration", "GPS latency", "GPS to sync", "Loop"};
+  return metric < PROFILE_METRICS ? NAMES[metric] : "unknown";
+}
+
+int formatRecord(const TelemetryRecord &r, char *text, size_t size)
+{
+  // The log text of the versions before the binary telemetry
+  switch (r.type) {
+  case TM_PHASE:
+    return snprintf(text, size, "LCD phase: %lu %lu %u %u", (unsigned long)(uint32_t)r.a, (unsigned long)(uint32_t)r.b,
+      (unsigned int)r.c, (unsigned int)r.d);
+  case TM_CALIBRATION:
+    return snprintf(text, size, "Micros: %lu\nMCU: %lu\nTrain: %lu ticks", (unsigned long)(uint32_t)r.a,
+      (unsigned long)(uint32_t)r.b, (unsigned long)(uint32_t)r.c);
+  case TM_RESIDUAL:
+    if (r.c != 0) {
+      return snprintf(text, size, "Residual: %ld ticks, MCU: %lu, qErr: %ld ns", (long)r.a, (unsigned long)(uint32_t)r.b,
+        (long)r.c * 1000 / 256);
+    }
+    return snprintf(text, size, "Residual: %ld ticks, MCU: %lu", (long)r.a, (unsigned long)(uint32_t)r.b);
+  case TM_SAVED:
+    return snprintf(text, size, "Saved MCU: %lu, age: %lu s, variance: %u", (unsigned long)(uint32_t)r.a,
+      (unsigned long)(uint32_t)r.b, (unsigned int)r.d);
+  case TM_AVOIDANCE:
+    return snprintf(text, size, "Avoidance triggered! OCR1A: %u, TCNT1: %u", (unsigned int)r.a, (unsigned int)r.b);
+  case TM_INTERVAL:
+    return snprintf(text, size, "Unexpected GPS pulse interval: %lu microseconds", (unsigned long)(uint32_t)r.a);
+  case TM_WARM_REJECTED:
+    return snprintf(text, size, "Warm start rejected. Deviation: %ld microseconds", (long)r.a);
+  case TM_WARM_START:
+    return snprintf(text, size, "Warm start");
+  case TM_REJECTED:
+    return snprintf(text, size, "GPS pulse rejected. Phase: %ld ticks", (long)r.a);
+  case TM_HOLDOVER_START:
+    return snprintf(text, size, "GPS pulse missing, holdover started");
+  case TM_HOLDOVER_END:
+    return snprintf(text, size, "Holdover ended after %lu s. Phase: %ld ticks, bound: %lu us",
+      (unsigned long)(uint32_t)r.a, (long)r.b, (unsigned long)(uint32_t)r.c);
+  case TM_LOCK_LOST:
+    return snprintf(text, size, "Lock with GPS signal lost");
+  case TM_SD_WRITE:
+    return snprintf(text, size, "SD sectors: %lu, write: %lu us, worst: %lu us, dropped: %u", (unsigned long)(uint32_t)r.a,
+      (unsigned long)(uint32_t)r.b, (unsigned long)(uint32_t)r.c, (unsigned int)r.d);
+  case TM_SD_STOPPED:
+    return snprintf(text, size, "SD log stopped after %lu sectors", (unsigned long)(uint32_t)r.a);
+  case TM_UTC: {
+    int n = snprintf(text, size, "UTC: ");
+    n += formatUtc(r.a, text + n, size - n);
+    return n + snprintf(text + n, size - n, ", fix: %s, correction: %ld s", r.d ? "yes" : "no", (long)r.b);
+  }
+  case TM_TASK:
+    return snprintf(text, size, "Task %u: worst: %lu us, overruns: %lu, deferred: %lu", (unsigned int)r.d,
+      (unsigned long)(uint32_t)r.a, (unsigned long)(uint32_t)r.b, (unsigned long)(uint32_t)r.c);
+  case TM_TASK_OVERRUN:
+    return snprintf(text, size, "Task %u overrun: %lu us, cost: %lu us", (unsigned int)r.d, (unsigned long)(uint32_t)r.a,
+      (unsigned long)(uint32_t)r.b);
+  case TM_PROFILE: {
+    // Mean with one decimal, without floating point on the MCU
+    uint32_t samples = r.a, sum = r.b;
+    uint32_t mean = samples ? sum / samples : 0;
+    uint32_t decimal = samples ? sum % samples * 10 / samples : 0;
+    return snprintf(text, size, "Profile %s: %lu samples, mean %lu.%lu, max %lu %s", profileMetricName(r.d),
+      (unsigned long)samples, (unsigned long)mean, (unsigned long)decimal, (unsigned long)(uint32_t)r.c,
+      r.d == PROFILE_LOOP ? "us" : "ticks");
+  }
+  case TM_PROFILE_BUCKETS: {
+    uint8_t first = r.d >> 8;
+    uint8_t last = first + PROFILE_FRAME_BUCKETS - 1 < PROFILE_BUCKETS ? first + PROFILE_FRAME_BUCKETS - 1 : PROFILE_BUCKETS - 1;
+    const uint32_t fields[3] = {(uint32_t)r.a, (uint32_t)r.b, (uint32_t)r.c};
+    int n = snprintf(text, size, "Profile %s buckets %u-%u:", profileMetricName(r.d & 0xFF), (unsigned int)first,
+      (unsigned int)last);
+    for (uint8_t i = 0; i <= last - first && n < (int)size; i++) {
+      n += snprintf(text + n, size - n, " %u", (unsigned int)(fields[i / 2] >> (16 * (i % 2)) & 0xFFFF));
+    }
+    return n;
+  }
+  case TM_SLEEP: {
+    // Active share with one decimal, without floating point on the MCU
+    uint32_t asleep = r.a, period = r.b;
+    uint32_t active = period > asleep ? period - asleep : 0;
+    uint32_t permille = period ? (uint32_t)((uint64_t)active * 1000 / period) : 0;
+    return snprintf(text, size, "Active: %lu.%lu%%, asleep: %lu ms of %lu ms, wake-ups: %lu", (unsigned long)(permille / 10),
+      (unsigned long)(permille % 10), (unsigned long)asleep, (unsigned long)period, (unsigned long)(uint32_t)r.c);
+  }
+  default:
+    return snprintf(text, size, "Unknown telemetry record type: %u", (unsigned int)r.type);
+  }
+}
+
+bool TelemetryDecoder::push(uint8_t c)
+{
+  if (nFrame == 0 && c != TELEMETRY_SYNC) {
+    // Plain log text, lines end with "\r\n" from Serial.println()
+    if (c == '\n') {
+      line[nLine] = 0;
+      nLine = 0;
+      return true;
+    }
+    if (c != '\r' && nLine < RECORD_TEXT_SIZE - 1) {
+      line[nLine++] = c;
+    }
+    return false;
+  }
+  frame[nFrame++] = c;
+  if (nFrame < FRAME_SIZE) {
+    return false;
+  }
+  TelemetryRecord record;
+  if (!decodeFrame(frame, record)) {
+    // Resynchronize on the next sync byte within the rejected bytes
+    uint8_t next = 1;
+    while (next < FRAME_SIZE && frame[next] != TELEMETRY_SYNC) {
+      next++;
+    }
+    nFrame = 0;
+    for (uint8_t i = next; i < FRAME_SIZE; i++) {
+      frame[nFrame++] = frame[i];
+    }
+    return false;
+  }
+  nFrame = 0;
+  if (synced) {
+    lost += (uint8_t)(record.seq - nextSeq);
+  }
+  synced = true;
+  nextSeq = record.seq + 1;
+  formatRecord(record, line, RECORD_TEXT_SIZE);
+  return true;
+}
@@ -3,39 +3,49 @@
  * for operating a meteor photography allsky station.
  */
 
-// Percentage of time that the LCD shutter receives a voltage (user editable in range [15, 70])
-// Advised value for standard grade LCtec shutters:   25
-// Advised value for fast X-grade LCtec shutters:     50
-#define SHUT_PERCENTAGE 25
+// The percentage of time that the LCD shutter receives a voltage is user editable in SHUTTER_CHANNELS, see
+// shutter_waveform.h, as well as the pins of additional LCD shutters
 
 #include "gps_shutter_control.h"
+#include "gps_time.h"
+#include "scheduler.h"
+#include "profiler.h"
 
 void setup()
 {
-  // For writing log messages to the serial console of the Arduino IDE
+  // For writing log messages to the serial console of the Arduino IDE, and for receiving the NMEA
+  // sentences of the GPS receiver with GPS_TIME (see gps_time.h)
   // Keep the baudrate low to prevent large numbers of interrupts from the serial interface
   Serial.begin(9600);
-
-  // Put setup logic for other control tasks here
+  #ifdef GPS_TIME
+  setupGpsTime();
+  #endif
+  #ifdef PROFILER
+  setupProfiler();
+  #endif
+
+  // Put setup logic for other control tasks here, and register each task with its worst-case execution
+  // time in microseconds, e.g. addTask(triggerCamera, 200)
   // ...
 
   // Keep this as final statement of the setup() function
-  setup_shutter_control(SHUT_PERCENTAGE);
+  setup_shutter_control();
 }
 
 void loop()
 {
-  // Put other control tasks here, but keep execution time per iteration within 20 milliseconds
-  // ...
+  #ifdef PROFILER
+  unsigned long loopMicros = micros();
+  #endif
 
   // Call the LCD shutter control each iteration of the loop
   run_shutter_control();
-}
 
-// Only edit if you know what you are doing
-#if SHUT_PERCENTAGE < 15
-#error "SHUT_PERCENTAGE should be larger or equal than 15"
-#endif
-#if SHUT_PERCENTAGE > 70
-#error "SHUT_PERCENTAGE should be smaller or equal than 70"
-#endif
\ No newline at end of file
+  // Run one of the registered tasks that fits before the next GPS pulse (see scheduler.h), instead of
+  // putting other control tasks here
+  runTasks();
+
+  #ifdef PROFILER
+  profileSample(PROFILE_LOOP, micros() - loopMicros);
+  #endif
+}